@@ -1,5 +1,4 @@
 #include "BLE_Client_Joystick.h"
-#include <NimBLEDevice.h>
 
 /*
  * This program is based on https://github.com/h2zero/NimBLE-Arduino/tree/master/examples/NimBLE_Client.
@@ -38,81 +37,46 @@
 // The device supports analog thumbstick in Game mode. I do not know if the
 // cheaper version does or not.
 // https://www.amazon.com/dp/B09QJLV6JJ
-
-// Joystick HID report format
-typedef struct __attribute__((__packed__))
-{
-  uint8_t x;
-  uint8_t y;
-  uint8_t z;
-  uint8_t rz;
-  uint8_t brake;
-  uint8_t accel;
-  uint8_t hat;
-  uint16_t buttons;
-} joystick_t;
+//
+// The report format, joystick_t, lives in Joystick_Decode.h.
 
 static const char HID_SERVICE[] = "1812";
 static const char HID_REPORT_MAP[] = "2A4B";
 static const char HID_REPORT_DATA[] = "2A4D";
-static const uint32_t scanTime = 50; /** 0 = scan forever */
-static void notifyCB(NimBLERemoteCharacteristic *pRemoteCharacteristic,
-                     uint8_t *pData, size_t length, bool isNotify);
-static void scanEndedCB(NimBLEScanResults results);
-static bool doConnect = false;
-static NimBLEAdvertisedDevice *advDevice;
-static joystick_t Joystick_Report;
-static bool Joystick_New_Data = false;
-
-/** Define a class to handle the callbacks when advertisments are received */
-class AdvertisedDeviceCallbacks : public NimBLEScanCallbacks
-{
-  void onResult(NimBLEAdvertisedDevice *advertisedDevice)
-  {
-    Serial.print("Advertised Device found: ");
-    Serial.println(advertisedDevice->toString().c_str());
-
-    if (advertisedDevice->haveServiceUUID() &&
-        advertisedDevice->isAdvertisingService(NimBLEUUID(HID_SERVICE)))
-    {
-      Serial.print("Advertised HID Device found: ");
-      Serial.println(advertisedDevice->toString().c_str());
-
-      /** stop scan before connecting */
-      NimBLEDevice::getScan()->stop();
-      /** Save the device reference in a global for the client to use*/
-      advDevice = advertisedDevice;
-      /** Read to connect now */
-      doConnect = true;
-    }
-  }
-};
-
-/** Create a single global instance of the callback class to be used by all
- * clients
- */
-
-/**  None of these are required as they will be handled by the library with defaults. **
- **                       Remove as you see fit for your needs                        */
-class ClientCallbacks : public NimBLEClientCallbacks
+static const char HID_BOOT_KEYBOARD[] = "2A22";
+static const char HID_BOOT_MOUSE[] = "2A33";
+static const char HID_PROTOCOL_MODE[] = "2A4E";
+static const char HID_BOOT_KEYBOARD_OUT[] = "2A32";
+static const char HID_REPORT_REFERENCE[] = "2908";
+static const uint8_t HID_REPORT_TYPE_OUTPUT = 2;
+static const char BATTERY_SERVICE[] = "180F";
+static const char BATTERY_LEVEL[] = "2A19";
+static const uint16_t APPEARANCE_JOYSTICK = 0x03C3;
+static const uint16_t APPEARANCE_GAMEPAD = 0x03C4;
+
+/** NimBLE callbacks are not bound to an object, there is one joystick */
+static BLE_Client_Joystick *self = nullptr;
+
+/** Runs in the BLE task */
+class BLE_Client_Joystick_Callbacks : public NimBLEClientCallbacks, public NimBLEScanCallbacks
 {
-  void onConnect(NimBLEClient *pClient)
+  void onConnect(NimBLEClient *pClient) override
   {
-    Serial.println("Connected");
+    Serial.printf("Connected\n");
     /** After connection we should change the parameters if we don't need fast response times.
-     *  These settings are 150ms interval, 0 latency, 450ms timout.
      *  Timeout should be a multiple of the interval, minimum is 100ms.
      *  I find a multiple of 3-5 * the interval works best for quick response/reconnect.
-     *  Min interval: 120 * 1.25ms = 150, Max interval: 120 * 1.25ms = 150, 0 latency, 60 * 10ms = 600ms timeout
+     *  Defaults: 120 * 1.25ms = 150ms interval, 0 latency, 60 * 10ms = 600ms timeout.
      */
-    pClient->updateConnParams(120, 120, 0, 60);
+    const ble_client_params_t &p = self->params;
+    pClient->updateConnParams(p.conn_itvl, p.conn_itvl, p.conn_latency, p.conn_tmo);
   }
 
-  void onDisconnect(NimBLEClient *pClient)
+  void onDisconnect(NimBLEClient *pClient, int reason) override
   {
-    Serial.print(pClient->getPeerAddress().toString().c_str());
-    Serial.println(" Disconnected - Starting scan");
-    NimBLEDevice::getScan()->start(scanTime, scanEndedCB);
+    Serial.printf("%s Disconnected, reason = %d - Starting scan\n",
+                  pClient->getPeerAddress().toString().c_str(), reason);
+    self->on_disconnect(reason);
   }
 
   /** Called when the peripheral requests a change to the connection parameters.
@@ -120,49 +84,273 @@ class ClientCallbacks : public NimBLEClientCallbacks
    *  the currently used parameters. Default will return true.
    */
   bool onConnParamsUpdateRequest(NimBLEClient *pClient,
-                                 const ble_gap_upd_params *params)
+                                 const ble_gap_upd_params *params) override
   {
     // Failing to accepts parameters may result in the remote device
     // disconnecting.
     return true;
   }
 
-  /********************* Security handled here **********************
-   ****** Note: these are the same return values as defaults ********/
-  uint32_t onPassKeyRequest()
+  /** The controller settled on a PHY, may differ from what was asked for */
+  void onPhyUpdate(NimBLEClient *pClient, uint8_t txPhy, uint8_t rxPhy) override
   {
-    Serial.println("Client Passkey Request");
-    /** return the passkey to send to the server */
-    return 123456;
+    Serial.printf("PHY updated, tx: %d rx: %d\n", txPhy, rxPhy);
+    self->post(BLE_EV_PHY, (txPhy << 8) | rxPhy);
   }
 
-  bool onConfirmPIN(uint32_t pass_key)
+  /********************* Security handled here *********************/
+  /****** Note: these are the same return values as defaults ********/
+  void onPassKeyEntry(NimBLEConnInfo &connInfo) override
   {
-    Serial.print("The passkey YES/NO number: ");
-    Serial.println(pass_key);
-    /** Return false if passkeys don't match. */
-    return true;
+    Serial.printf("Server Passkey Entry\n");
+    /** This should prompt the user to enter the passkey displayed on the peer device. */
+    NimBLEDevice::injectPassKey(connInfo, 123456);
+  }
+
+  void onConfirmPasskey(NimBLEConnInfo &connInfo, uint32_t pass_key) override
+  {
+    Serial.printf("The passkey YES/NO number: %" PRIu32 "\n", pass_key);
+    /** Inject false if passkeys don't match. */
+    NimBLEDevice::injectConfirmPasskey(connInfo, true);
   }
 
-  /** Pairing process complete, we can check the results in ble_gap_conn_desc */
-  void onAuthenticationComplete(ble_gap_conn_desc *desc)
+  /** Pairing process complete, we can check the results in connInfo */
+  void onAuthenticationComplete(NimBLEConnInfo &connInfo) override
   {
-    if (!desc->sec_state.encrypted)
+    if (!connInfo.isEncrypted())
     {
-      Serial.println("Encrypt connection failed - disconnecting");
-      /** Find the client with the connection handle provided in desc */
-      NimBLEDevice::getClientByHandle(desc->conn_handle)->disconnect();
+      Serial.printf("Encrypt connection failed - disconnecting\n");
+      /** Find the client with the connection handle provided in connInfo */
+      NimBLEDevice::getClientByHandle(connInfo.getConnHandle())->disconnect();
       return;
     }
   }
+
+  void onResult(const NimBLEAdvertisedDevice *advertisedDevice) override
+  {
+    Serial.printf("Advertised Device found: %s\n", advertisedDevice->toString().c_str());
+    if (self->connecting || !advertisedDevice->isAdvertisingService(NimBLEUUID(HID_SERVICE)))
+      return;
+
+    Serial.printf("Found Our Service: %s\n", advertisedDevice->toString().c_str());
+    /** Keeps onScanEnd() from restarting the scan we stop here */
+    self->connecting = true;
+    self->adv_device = advertisedDevice;
+    NimBLEDevice::getScan()->stop();
+    /** Connecting blocks, leave it to the connect task */
+    xTaskNotifyGive(self->connect_task);
+  }
+
+  /** Restart the scan unless it was stopped to connect */
+  void onScanEnd(const NimBLEScanResults &results, int reason) override
+  {
+    Serial.printf("Scan Ended, reason: %d, device count: %d\n", reason, results.getCount());
+    if (!self->connecting && !self->is_connected())
+      self->start_scan();
+  }
 };
 
-ClientCallbacks clientCB;
+static BLE_Client_Joystick_Callbacks callbacks;
+
+void BLE_Client_Joystick::begin()
+{
+  self = this;
+  queue = xQueueCreate(BLE_EVENT_QUEUE_SIZE, sizeof(ble_event_t));
+  xTaskCreate(connect_task_main, "ble_connect", 4096, this, 1, &connect_task);
+
+  /** Initialize NimBLE, no device name spcified as we are not advertising */
+  NimBLEDevice::init("");
+
+  /** Set the IO capabilities of the device, each option will trigger a different pairing method.
+   *  BLE_HS_IO_KEYBOARD_ONLY    - Passkey pairing
+   *  BLE_HS_IO_DISPLAY_YESNO   - Numeric comparison pairing
+   *  BLE_HS_IO_NO_INPUT_OUTPUT - DEFAULT setting - just works pairing
+   */
+  // NimBLEDevice::setSecurityIOCap(BLE_HS_IO_KEYBOARD_ONLY); // use passkey
+  // NimBLEDevice::setSecurityIOCap(BLE_HS_IO_DISPLAY_YESNO); //use numeric comparison
+
+  /** 2 different ways to set security - both calls achieve the same result.
+   *  no bonding, no man in the middle protection, secure connections.
+   *
+   *  These are the default values, only shown here for demonstration.
+   */
+  NimBLEDevice::setSecurityAuth(true, false, true);
+  // NimBLEDevice::setSecurityAuth(/*BLE_SM_PAIR_AUTHREQ_BOND | BLE_SM_PAIR_AUTHREQ_MITM |*/ BLE_SM_PAIR_AUTHREQ_SC);
+
+  /** Optional: set the transmit power, default is 3db */
+  NimBLEDevice::setPower(ESP_PWR_LVL_P9); /** +9db */
+
+  /** Optional: set any devices you don't want to get advertisments from */
+  // NimBLEDevice::addIgnored(NimBLEAddress ("aa:bb:cc:dd:ee:ff"));
+
+  NimBLEScan *pScan = NimBLEDevice::getScan();
+
+  /** Set the callbacks to call when scan events occur, no duplicates */
+  pScan->setScanCallbacks(&callbacks, false);
+
+  /** Active scan will gather scan response data from advertisers
+   *  but will use more energy from both devices
+   */
+  pScan->setActiveScan(true);
+  start_scan();
+  Serial.printf("Scanning for peripherals\n");
+}
+
+bool BLE_Client_Joystick::poll(ble_event_t &event, uint32_t wait_ms)
+{
+  if (!queue)
+  {
+    /** Not started, still honour the wait so callers can pace on it */
+    if (wait_ms)
+      delay(wait_ms);
+    return false;
+  }
+  return xQueueReceive(queue, &event, pdMS_TO_TICKS(wait_ms)) == pdTRUE;
+}
+
+void BLE_Client_Joystick::loop()
+{
+  ble_event_t event;
+  while (poll(event))
+  {
+    if (event.type == BLE_EV_DISCONNECTED)
+    {
+      button_edges.reset();
+      continue;
+    }
+    if (event.type != BLE_EV_REPORT)
+      continue;
+    // WARNING: The "Fortune Key/Game" has 4 Characteristics = 0x2a4d but
+    // with different handle values, its joystick is on handle 56.
+    joystick_t report;
+    if ((report_handle && event.handle != report_handle) ||
+        !decode_report(event.data, event.length, report))
+      continue;
+
+    movement_callback_t f = this->get_movement_callback();
+    if (f)
+    {
+      if ((last_x != report.x) || (last_y != report.y))
+      {
+        (*f)(report.x, report.y);
+        last_x = report.x;
+        last_y = report.y;
+      }
+    }
+    button_edges.dispatch(report.buttons, button_functions);
+  }
+}
+
+bool BLE_Client_Joystick::write_output(uint8_t output, const uint8_t *data, size_t length)
+{
+  NimBLERemoteCharacteristic *pChr = output == BLE_OUT_RUMBLE ? rumble_chr : led_chr;
+  if (!pChr || !is_connected())
+    return false;
+  /** Only write-without-response targets are kept, nothing waits for the peer */
+  return pChr->writeValue(data, length, false);
+}
+
+/** Queue an event for poll(), never blocks the BLE task */
+void BLE_Client_Joystick::post(uint8_t type, int32_t value, const uint8_t *data,
+                               size_t length, uint16_t handle)
+{
+  if (!queue)
+    return;
+  ble_event_t event;
+  event.type = type;
+  event.length = length > BLE_EVENT_DATA_SIZE ? BLE_EVENT_DATA_SIZE : length;
+  event.handle = handle;
+  event.value = value;
+  event.t_us = micros();
+  if (event.length)
+    memcpy(event.data, data, event.length);
+  if (xQueueSend(queue, &event, 0) != pdTRUE)
+    dropped++;
+}
+
+void BLE_Client_Joystick::start_scan()
+{
+  /** Set scan interval (how often) and window (how long) in milliseconds */
+  NimBLEScan *pScan = NimBLEDevice::getScan();
+  pScan->setInterval(params.scan_interval_ms);
+  pScan->setWindow(params.scan_window_ms);
+  pScan->start(params.scan_time_ms, false, true);
+}
+
+void BLE_Client_Joystick::on_disconnect(int reason)
+{
+  client = nullptr;
+  rumble_chr = nullptr;
+  led_chr = nullptr;
+  /** Before anything is queued, whoever drives motors must not wait for poll() */
+  if (connection_function)
+    (*connection_function)(false);
+  post(BLE_EV_DISCONNECTED, reason);
+  if (!connecting)
+    start_scan();
+}
+
+/** Waits for onResult() to hand over a device, then connects to it */
+void BLE_Client_Joystick::connect_task_main(void *arg)
+{
+  BLE_Client_Joystick *joystick = (BLE_Client_Joystick *)arg;
+  for (;;)
+  {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    if (joystick->connect_to_server())
+    {
+      Serial.printf("Success! we should now be getting notifications!\n");
+      joystick->connecting = false;
+      if (joystick->connection_function)
+        (*joystick->connection_function)(true);
+      joystick->post(BLE_EV_CONNECTED, joystick->boot_device);
+    }
+    else
+    {
+      Serial.printf("Failed to connect, starting scan\n");
+      joystick->connecting = false;
+      joystick->post(BLE_EV_CONNECT_FAILED, 0);
+      joystick->start_scan();
+    }
+  }
+}
+
+/** Empty when the peer has none or does not let it be read */
+static NimBLEAttValue read_report_map(NimBLERemoteService *pSvc)
+{
+  NimBLERemoteCharacteristic *pMap = pSvc->getCharacteristic(HID_REPORT_MAP);
+  if (pMap && pMap->canRead())
+    return pMap->readValue();
+  return NimBLEAttValue();
+}
+
+/** Boot reports and nothing to drive with in Report Protocol. Many gamepads
+ *  advertise no appearance, so the Report Map decides: boot mode only when
+ *  it declares a keyboard or mouse and no joystick or gamepad. Without a
+ *  readable map, only when there is no 0x2A4D input report at all. */
+static bool is_boot_only(NimBLERemoteService *pSvc)
+{
+  NimBLERemoteCharacteristic *pKeyboard = pSvc->getCharacteristic(HID_BOOT_KEYBOARD);
+  NimBLERemoteCharacteristic *pMouse = pSvc->getCharacteristic(HID_BOOT_MOUSE);
+  if (!(pKeyboard && pKeyboard->canNotify()) && !(pMouse && pMouse->canNotify()))
+    return false;
+
+  NimBLEAttValue map = read_report_map(pSvc);
+  uint8_t apps = report_map_applications(map.data(), map.size());
+  if (apps)
+    return !(apps & (HID_APP_JOYSTICK | HID_APP_GAMEPAD));
+  for (auto &it : pSvc->getCharacteristics(true))
+  {
+    if (it->getUUID() == NimBLEUUID(HID_REPORT_DATA) && it->canNotify())
+      return false;
+  }
+  return true;
+}
 
 /** Handles the provisioning of clients and connects / interfaces with
  * the server
  */
-bool connectToServer()
+bool BLE_Client_Joystick::connect_to_server()
 {
   NimBLEClient *pClient = nullptr;
 
@@ -173,15 +361,15 @@ bool connectToServer()
      *  second argument in connect() to prevent refreshing the service database.
      *  This saves considerable time and power.
      */
-    pClient = NimBLEDevice::getClientByPeerAddress(advDevice->getAddress());
+    pClient = NimBLEDevice::getClientByPeerAddress(adv_device->getAddress());
     if (pClient)
     {
-      if (!pClient->connect(advDevice, false))
+      if (!pClient->connect(adv_device, false))
       {
-        Serial.println("Reconnect failed");
+        Serial.printf("Reconnect failed\n");
         return false;
       }
-      Serial.println("Reconnected client");
+      Serial.printf("Reconnected client\n");
     }
     /** We don't already have a client that knows this device,
      *  we will check for a client that is disconnected that we can use.
@@ -197,196 +385,192 @@ bool connectToServer()
   {
     if (NimBLEDevice::getCreatedClientCount() >= NIMBLE_MAX_CONNECTIONS)
     {
-      Serial.println("Max clients reached - no more connections available");
+      Serial.printf("Max clients reached - no more connections available\n");
       return false;
     }
 
     pClient = NimBLEDevice::createClient();
 
-    Serial.println("New client created");
+    Serial.printf("New client created\n");
 
-    pClient->setClientCallbacks(&clientCB, false);
-    /** Set initial connection parameters: These settings are 15ms interval, 0 latency, 120ms timout.
-     *  These settings are safe for 3 clients to connect reliably, can go faster if you have less
-     *  connections. Timeout should be a multiple of the interval, minimum is 100ms.
-     *  Min interval: 12 * 1.25ms = 15, Max interval: 12 * 1.25ms = 15, 0 latency, 51 * 10ms = 510ms timeout
+    pClient->setClientCallbacks(&callbacks, false);
+    /** Set initial connection parameters: Timeout should be a multiple of the interval,
+     *  minimum is 100ms. The defaults are safe for 3 clients to connect reliably, can go
+     *  faster if you have less connections.
+     *  Defaults: 12 * 1.25ms = 15ms interval, 0 latency, 51 * 10ms = 510ms timeout.
      */
-    pClient->setConnectionParams(12, 12, 0, 51);
+    pClient->setConnectionParams(params.conn_init_itvl, params.conn_init_itvl, 0, params.conn_init_tmo);
     /** Set how long we are willing to wait for the connection to complete
-     * (seconds), default is 30.
+     * (milliseconds), default is 30000.
      */
-    pClient->setConnectTimeout(5);
+    pClient->setConnectTimeout(5 * 1000);
 
-    if (!pClient->connect(advDevice))
+    if (!pClient->connect(adv_device))
     {
       /** Created a client but failed to connect, don't need to keep it as it
        * has no data
        */
       NimBLEDevice::deleteClient(pClient);
-      Serial.println("Failed to connect, deleted client");
+      Serial.printf("Failed to connect, deleted client\n");
       return false;
     }
   }
 
   if (!pClient->isConnected())
   {
-    if (!pClient->connect(advDevice))
+    if (!pClient->connect(adv_device))
     {
-      Serial.println("Failed to connect");
+      Serial.printf("Failed to connect\n");
       return false;
     }
   }
 
-  Serial.print("Connected to: ");
-  Serial.println(pClient->getPeerAddress().toString().c_str());
-  Serial.print("RSSI: ");
-  Serial.println(pClient->getRssi());
+  Serial.printf("Connected to: %s RSSI: %d\n",
+                pClient->getPeerAddress().toString().c_str(),
+                pClient->getRssi());
 
   /** Now we can read/write/subscribe the charateristics of the services we
    * are interested in
    */
   NimBLERemoteService *pSvc = pClient->getService(HID_SERVICE);
-  // NimBLERemoteCharacteristic *pChr = nullptr;
-  // NimBLERemoteDescriptor *pDsc = nullptr;
-
+  rumble_chr = nullptr;
+  led_chr = nullptr;
+  boot_device = false;
   if (pSvc)
   { /** make sure it's not null */
-    // Subscribe to characteristics HID_REPORT_DATA.
-    // One real device reports 2 with the same UUID but
-    // different handles. Using getCharacteristic() results
-    // in subscribing to only one.
-    const std::vector<NimBLERemoteCharacteristic *> &charvector = pSvc->getCharacteristics(true);
-    for (auto &it : charvector)
+    uint16_t appearance = adv_device->getAppearance();
+    if (appearance != APPEARANCE_JOYSTICK && appearance != APPEARANCE_GAMEPAD)
     {
-      if (it->getUUID() == NimBLEUUID(HID_REPORT_DATA))
-      {
-        Serial.println(it->toString().c_str());
-        if (it->canNotify())
-        {
-          if (!it->subscribe(true, notifyCB))
-          {
-            /** Disconnect if subscribe failed */
-            Serial.println("subscribe notification failed");
-            pClient->disconnect();
-            return false;
-          }
-        }
-      }
+      boot_device = is_boot_only(pSvc);
+    }
+    if (!(boot_device ? subscribe_boot_reports(pSvc) : subscribe_reports(pSvc)))
+    {
+      /** Disconnect if subscribe failed */
+      Serial.printf("subscribe notification failed\n");
+      pClient->disconnect();
+      return false;
     }
   }
-  Serial.println("Done with this device!");
+
+  subscribe_battery(pClient);
+
+  client = pClient;
+  Serial.printf("Done with this device!\n");
   return true;
 }
 
-void BLE_Client_Joystick::begin()
+/** Output reports are the 0x2A4D characteristics whose Report Reference says
+ *  so. Returns the report ID, -1 for anything else. */
+static int output_report_id(NimBLERemoteCharacteristic *pChr)
 {
-  /** Initialize NimBLE, no device name spcified as we are not advertising */
-  NimBLEDevice::init("");
-
-  /** Set the IO capabilities of the device, each option will trigger a different pairing method.
-   *  BLE_HS_IO_KEYBOARD_ONLY    - Passkey pairing
-   *  BLE_HS_IO_DISPLAY_YESNO   - Numeric comparison pairing
-   *  BLE_HS_IO_NO_INPUT_OUTPUT - DEFAULT setting - just works pairing
-   */
-  // NimBLEDevice::setSecurityIOCap(BLE_HS_IO_KEYBOARD_ONLY); // use passkey
-  // NimBLEDevice::setSecurityIOCap(BLE_HS_IO_DISPLAY_YESNO); //use numeric comparison
-
-  /** 2 different ways to set security - both calls achieve the same result.
-   *  no bonding, no man in the middle protection, secure connections.
-   *
-   *  These are the default values, only shown here for demonstration.
-   */
-  NimBLEDevice::setSecurityAuth(true, false, true);
-  // NimBLEDevice::setSecurityAuth(/*BLE_SM_PAIR_AUTHREQ_BOND | BLE_SM_PAIR_AUTHREQ_MITM |*/ BLE_SM_PAIR_AUTHREQ_SC);
-
-  /** Optional: set the transmit power, default is 3db */
-  NimBLEDevice::setPower(ESP_PWR_LVL_P9); /** +9db */
-
-  /** Optional: set any devices you don't want to get advertisments from */
-  // NimBLEDevice::addIgnored(NimBLEAddress ("aa:bb:cc:dd:ee:ff"));
-
-  /** create new scan */
-  NimBLEScan *pScan = NimBLEDevice::getScan();
-
-  /** create a callback that gets called when advertisers are found */
-  pScan->setScanCallbacks(new AdvertisedDeviceCallbacks());
-
-  /** Set scan interval (how often) and window (how long) in milliseconds */
-  pScan->setInterval(45);
-  pScan->setWindow(15);
-
-  /** Active scan will gather scan response data from advertisers
-   *  but will use more energy from both devices
-   */
-  pScan->setActiveScan(true);
-  /** Start scanning for advertisers for the scan time specified (in seconds) 0 = forever
-   *  Optional callback for when scanning stops.
-   */
-  pScan->start(scanTime, scanEndedCB);
-  Serial.println("pScan->start");
+  NimBLERemoteDescriptor *pRef = pChr->getDescriptor(HID_REPORT_REFERENCE);
+  if (!pRef)
+    return -1;
+  NimBLEAttValue ref = pRef->readValue();
+  return ref.size() >= 2 && ref.data()[1] == HID_REPORT_TYPE_OUTPUT ? ref.data()[0] : -1;
 }
 
-void BLE_Client_Joystick::loop()
+/** A force feedback report in the layout Hid_Feedback::rumble() builds */
+static bool is_rumble_report(const NimBLEAttValue &map, int report_id)
 {
-  /** Loop here until we find a device we want to connect to */
-  if (doConnect)
-  {
-    doConnect = false;
+  bool pid;
+  size_t size = report_map_output_size(map.data(), map.size(), report_id, pid);
+  return pid && size == BLE_RUMBLE_REPORT_SIZE;
+}
 
-    /** Found a device we want to connect to, do it now */
-    if (!connectToServer())
-    {
-      NimBLEDevice::getScan()->start(scanTime, scanEndedCB);
-    }
-  }
-  // Processing incoming notifications/indications
-  if (Joystick_New_Data)
+bool BLE_Client_Joystick::subscribe_reports(NimBLERemoteService *pSvc)
+{
+  // Subscribe to characteristics HID_REPORT_DATA.
+  // One real device reports 2 with the same UUID but
+  // different handles. Using getCharacteristic() results
+  // in subscribing to only one.
+  const std::vector<NimBLERemoteCharacteristic *> &charvector = pSvc->getCharacteristics(true);
+  NimBLEAttValue map = read_report_map(pSvc);
+  for (auto &it : charvector)
   {
-    static uint8_t last_x;
-    static uint8_t last_y;
-    movement_callback_t f = this->get_movement_callback();
-    if (f)
-    {
-      if ((last_x != Joystick_Report.x) || (last_y != Joystick_Report.y))
-      {
-        (*f)(Joystick_Report.x, Joystick_Report.y);
-        last_x = Joystick_Report.x;
-        last_y = Joystick_Report.y;
-      }
-    }
-    static uint16_t last_buttons = 0;
-    uint16_t changed = last_buttons ^ Joystick_Report.buttons;
-    uint16_t buttons = Joystick_Report.buttons;
-    for (size_t i = 0; i < 16; i++)
+    if (it->getUUID() != NimBLEUUID(HID_REPORT_DATA))
+      continue;
+    int output_id = output_report_id(it);
+    if (output_id >= 0)
     {
-      button_callback_t f = this->get_button_callback(i);
-      if (f && (changed & 1))
+      /** A write with response would block loop() for a round trip */
+      if (!rumble_chr && it->canWriteNoResponse() && is_rumble_report(map, output_id))
       {
-        (*f)(buttons & 1);
+        Serial.printf("Rumble output report %d: %s\n", output_id, it->toString().c_str());
+        rumble_chr = it;
       }
-      changed >>= 1;
-      buttons >>= 1;
+      continue;
     }
-    last_buttons = Joystick_Report.buttons;
-    Joystick_New_Data = false;
+    Serial.printf("Subscribe to characteristics HID_REPORT_DATA: %s\n", it->toString().c_str());
+    if (it->canNotify() && !it->subscribe(true, report_cb))
+      return false;
   }
+  return true;
 }
 
-/** Notification / Indication receiving handler callback */
-// WARNING: This device has 4 Characteristics = 0x2a4d but with different
-// handle values.
-static void notifyCB(NimBLERemoteCharacteristic *pRemoteCharacteristic,
-                     uint8_t *pData, size_t length, bool isNotify)
+/** Switch the peer to Boot Protocol and subscribe to its fixed format reports */
+bool BLE_Client_Joystick::subscribe_boot_reports(NimBLERemoteService *pSvc)
 {
-  if (pRemoteCharacteristic->getHandle() == 56)
+  NimBLERemoteCharacteristic *pMode = pSvc->getCharacteristic(HID_PROTOCOL_MODE);
+  if (pMode)
+  {
+    uint8_t boot_protocol = 0;
+    pMode->writeValue(&boot_protocol, 1, false);
+  }
+
+  NimBLERemoteCharacteristic *pKeyboard = pSvc->getCharacteristic(HID_BOOT_KEYBOARD);
+  if (pKeyboard && pKeyboard->canNotify())
+  {
+    Serial.printf("Subscribe to boot keyboard: %s\n", pKeyboard->toString().c_str());
+    if (!pKeyboard->subscribe(true, keyboard_cb))
+      return false;
+  }
+  NimBLERemoteCharacteristic *pMouse = pSvc->getCharacteristic(HID_BOOT_MOUSE);
+  if (pMouse && pMouse->canNotify())
   {
-    memcpy(&Joystick_Report, pData, sizeof(Joystick_Report));
-    Joystick_New_Data = true;
+    Serial.printf("Subscribe to boot mouse: %s\n", pMouse->toString().c_str());
+    if (!pMouse->subscribe(true, mouse_cb))
+      return false;
   }
+  NimBLERemoteCharacteristic *pLeds = pSvc->getCharacteristic(HID_BOOT_KEYBOARD_OUT);
+  if (pLeds && pLeds->canWriteNoResponse())
+    led_chr = pLeds;
+  return true;
+}
+
+/** Read, and follow where possible, the peer's battery level */
+void BLE_Client_Joystick::subscribe_battery(NimBLEClient *pClient)
+{
+  NimBLERemoteService *pSvc = pClient->getService(BATTERY_SERVICE);
+  if (!pSvc)
+    return;
+  NimBLERemoteCharacteristic *pChr = pSvc->getCharacteristic(BATTERY_LEVEL);
+  if (!pChr)
+    return;
+  if (pChr->canRead())
+    post(BLE_EV_BATTERY, pChr->readValue<uint8_t>());
+  if (pChr->canNotify())
+    pChr->subscribe(true, battery_cb);
+}
+
+/** Notification / Indication receiving handler callbacks, all run in the BLE task */
+void BLE_Client_Joystick::report_cb(NimBLERemoteCharacteristic *pChr, uint8_t *pData, size_t length, bool isNotify)
+{
+  self->post(BLE_EV_REPORT, isNotify, pData, length, pChr->getHandle());
+}
+
+void BLE_Client_Joystick::keyboard_cb(NimBLERemoteCharacteristic *pChr, uint8_t *pData, size_t length, bool isNotify)
+{
+  self->post(BLE_EV_KEYBOARD, isNotify, pData, length, pChr->getHandle());
+}
+
+void BLE_Client_Joystick::mouse_cb(NimBLERemoteCharacteristic *pChr, uint8_t *pData, size_t length, bool isNotify)
+{
+  self->post(BLE_EV_MOUSE, isNotify, pData, length, pChr->getHandle());
 }
 
-/** Callback to process the results of the last scan or restart it */
-static void scanEndedCB(NimBLEScanResults results)
+void BLE_Client_Joystick::battery_cb(NimBLERemoteCharacteristic *pChr, uint8_t *pData, size_t length, bool isNotify)
 {
-  Serial.println("Scan Ended");
+  if (length)
+    self->post(BLE_EV_BATTERY, pData[0]);
 }
@@ -1,5 +1,8 @@
+#pragma once
+
 #include <Arduino.h>
 #include <NimBLEDevice.h>
+#include <Joystick_Decode.h>
 
 enum JOY_BUTTONS {
   JOY_A = 11,
@@ -15,18 +18,137 @@ typedef void (*button_callback_t)(bool);
 typedef void (*movement_callback_t)(int, int);
 typedef void (*connect_callback_t)(bool);
 
+// What poll() hands out, posted from the BLE task
+enum BLE_EVENTS {
+  BLE_EV_CONNECTED = 0,  /** subscribed and ready, value: 1 for a boot keyboard / mouse */
+  BLE_EV_DISCONNECTED,   /** value: reason */
+  BLE_EV_CONNECT_FAILED, /** scanning again */
+  BLE_EV_REPORT,         /** gamepad input report in data */
+  BLE_EV_KEYBOARD,       /** boot keyboard report in data */
+  BLE_EV_MOUSE,          /** boot mouse report in data */
+  BLE_EV_BATTERY,        /** value: gamepad battery percent */
+  BLE_EV_PHY             /** value: tx PHY << 8 | rx PHY */
+};
+
+// Output reports write_output() can target. Only characteristics that take
+// write-without-response are used, so a write never waits for the peer.
+enum BLE_OUTPUTS {
+  BLE_OUT_RUMBLE = 0, /** gamepad force feedback output report, see below */
+  BLE_OUT_LED         /** boot keyboard LED report */
+};
+
+/** The rumble target is the output report the Report Map declares as this
+ *  many bytes on the force feedback page: the Xbox style layout. */
+#define BLE_RUMBLE_REPORT_SIZE 8
+
+#define BLE_EVENT_DATA_SIZE 16
+#define BLE_EVENT_QUEUE_SIZE 32
+
+typedef struct
+{
+  uint8_t type;    /** BLE_EVENTS */
+  uint8_t length;  /** bytes used in data */
+  uint16_t handle; /** characteristic the report came from */
+  int32_t value;
+  uint32_t t_us;   /** micros() when the BLE task received it */
+  uint8_t data[BLE_EVENT_DATA_SIZE];
+} ble_event_t;
+
+// Scan and connection parameters, intervals in 1.25ms and timeouts in 10ms units
+typedef struct
+{
+  uint16_t scan_interval_ms;
+  uint16_t scan_window_ms;
+  uint32_t scan_time_ms;   /** 0 = scan forever */
+  uint16_t conn_init_itvl; /** while connecting */
+  uint16_t conn_init_tmo;
+  uint16_t conn_itvl;      /** requested once connected */
+  uint16_t conn_latency;
+  uint16_t conn_tmo;
+} ble_client_params_t;
+
+// NimBLE 2.x HID host for gamepads, keyboards, mice and presenters.
+//
+// Scanning and notifications run in the BLE task and connecting runs in a
+// task of its own, so nothing here blocks the caller. Everything that
+// happens is queued as a ble_event_t for poll(). loop() is the callback
+// style alternative: it drains poll() into the button, movement and connect
+// callbacks. Use one or the other.
+//
+// The connect callback is the exception: it is called right away from the
+// BLE task, before the matching event is polled, so it can be used as a
+// failsafe.
 class BLE_Client_Joystick {
  public:
     BLE_Client_Joystick() {
       movement_function = NULL;
       connection_function = NULL;
       memset(button_functions, 0, sizeof(button_functions));
+      params = {100, 100, 5000, 12, 51, 120, 0, 60};
+      queue = NULL;
+      connect_task = NULL;
+      client = nullptr;
+      adv_device = nullptr;
+      rumble_chr = nullptr;
+      led_chr = nullptr;
+      boot_device = false;
+      connecting = false;
+      report_handle = 56; /** the "Fortune Key/Game" joystick, see loop() */
+      dropped = 0;
+      last_x = last_y = 0;
     }
 
     ~BLE_Client_Joystick() {}
     void begin();
+    void begin(const ble_client_params_t &p) {
+      params = p;
+      begin();
+    }
     void end() {}
+    /** Next event, waits at most wait_ms for one. false if there is none. */
+    bool poll(ble_event_t &event, uint32_t wait_ms = 0);
+    /** Dispatch pending events to the callbacks below */
     void loop();
+
+    /** Scan changes apply to the next scan, connection ones to the next connect */
+    void set_params(const ble_client_params_t &p) { params = p; }
+    const ble_client_params_t &get_params() { return params; }
+    /** loop() only dispatches 0x2A4D reports from this handle, 0 = all of them.
+     *  poll() hands out every report with its handle. */
+    void set_report_handle(uint16_t handle) { report_handle = handle; }
+
+    /** Connected and subscribed */
+    bool is_connected() {
+      NimBLEClient *c = client;
+      return c && c->isConnected();
+    }
+    /** A keyboard, mouse or presenter in Boot Protocol rather than a gamepad */
+    bool is_boot_device() { return boot_device; }
+    int get_rssi() {
+      NimBLEClient *c = client;
+      return c && c->isConnected() ? c->getRssi() : 0;
+    }
+    /** 1.25ms units, 0 when not connected */
+    uint16_t get_conn_interval() {
+      NimBLEClient *c = client;
+      return c && c->isConnected() ? c->getConnInfo().getConnInterval() : 0;
+    }
+    bool update_phy(uint8_t phy_mask, uint16_t phy_options) {
+      NimBLEClient *c = client;
+      return c && c->isConnected() && c->updatePhy(phy_mask, phy_mask, phy_options);
+    }
+    bool update_conn_params(uint16_t itvl, uint16_t latency, uint16_t tmo) {
+      NimBLEClient *c = client;
+      return c && c->isConnected() && c->updateConnParams(itvl, itvl, latency, tmo);
+    }
+    bool has_output(uint8_t output) {
+      return (output == BLE_OUT_RUMBLE ? rumble_chr : led_chr) != nullptr;
+    }
+    /** Write without response, false if the peer has no such output */
+    bool write_output(uint8_t output, const uint8_t *data, size_t length);
+    /** Events lost because the queue was full */
+    uint32_t get_dropped_events() { return dropped; }
+
     void set_connect_callback(connect_callback_t f) { connection_function = f; }
     connect_callback_t get_connect_callback() { return connection_function; }
     void set_button_A_callback(button_callback_t f) {
@@ -58,8 +180,37 @@ class BLE_Client_Joystick {
     movement_callback_t get_movement_callback() { return movement_function; }
 
  private:
+    friend class BLE_Client_Joystick_Callbacks;
+
+    void post(uint8_t type, int32_t value, const uint8_t *data = nullptr,
+              size_t length = 0, uint16_t handle = 0);
+    void start_scan();
+    bool connect_to_server();
+    bool subscribe_reports(NimBLERemoteService *pSvc);
+    bool subscribe_boot_reports(NimBLERemoteService *pSvc);
+    void subscribe_battery(NimBLEClient *pClient);
+    void on_disconnect(int reason);
+    static void connect_task_main(void *arg);
+    static void report_cb(NimBLERemoteCharacteristic *pChr, uint8_t *pData, size_t length, bool isNotify);
+    static void keyboard_cb(NimBLERemoteCharacteristic *pChr, uint8_t *pData, size_t length, bool isNotify);
+    static void mouse_cb(NimBLERemoteCharacteristic *pChr, uint8_t *pData, size_t length, bool isNotify);
+    static void battery_cb(NimBLERemoteCharacteristic *pChr, uint8_t *pData, size_t length, bool isNotify);
+
     button_callback_t button_functions[16];
     movement_callback_t movement_function;
     connect_callback_t connection_function;
-};
+    Button_Edges button_edges;
+    uint8_t last_x, last_y;
 
+    ble_client_params_t params;
+    QueueHandle_t queue;
+    TaskHandle_t connect_task;
+    NimBLEClient *volatile client;
+    const NimBLEAdvertisedDevice *adv_device;
+    NimBLERemoteCharacteristic *rumble_chr;
+    NimBLERemoteCharacteristic *led_chr;
+    volatile bool boot_device;
+    volatile bool connecting;
+    uint16_t report_handle;
+    volatile uint32_t dropped;
+};
@@ -0,0 +1,281 @@
+#include "Config_Store.h"
+#include <Preferences.h>
+
+static const char NVS_NAMESPACE[] = "hidcfg";
+
+struct config_param_t
+{
+  const char *key; /** also the NVS key, at most 15 characters */
+  int32_t config_t::*field;
+  int32_t min;
+  int32_t max;
+  uint32_t pins; /** valid GPIOs for pin parameters, 0 = any value in range */
+};
+
+static const config_param_t PARAMS[] = {
+    {"scan_interval", &config_t::scan_interval_ms, 3, 10240},
+    {"scan_window", &config_t::scan_window_ms, 3, 10240},
+    {"scan_time", &config_t::scan_time_ms, 0, 600000},
+    {"conn_init_itvl", &config_t::conn_init_itvl, 6, 3200},
+    {"conn_init_tmo", &config_t::conn_init_tmo, 10, 3200},
+    {"conn_itvl", &config_t::conn_itvl, 6, 3200},
+    {"conn_latency", &config_t::conn_latency, 0, 499},
+    {"conn_tmo", &config_t::conn_tmo, 10, 3200},
+    {"pwm_limit", &config_t::pwm_limit, 0, 255},
+    {"axis_scale", &config_t::axis_scale, 0, 400},
+    {"pin_a1", &config_t::pin_a1, 0, 31, CONFIG_OUTPUT_PINS},
+    {"pin_a2", &config_t::pin_a2, 0, 31, CONFIG_OUTPUT_PINS},
+    {"pin_b1", &config_t::pin_b1, 0, 31, CONFIG_OUTPUT_PINS},
+    {"pin_b2", &config_t::pin_b2, 0, 31, CONFIG_OUTPUT_PINS},
+    {"render_delay", &config_t::render_delay_us, 0, 200000},
+    {"max_extrap", &config_t::max_extrap_us, 0, 200000},
+    {"link_near_rssi", &config_t::link_near_rssi, -127, 20},
+    {"link_far_rssi", &config_t::link_far_rssi, -127, 20},
+    {"link_sample_ms", &config_t::link_sample_ms, 50, 60000},
+    {"pin_batt", &config_t::pin_batt, -1, 31, CONFIG_ADC_PINS},
+    {"pin_sense_a", &config_t::pin_sense_a, -1, 31, CONFIG_ADC_PINS},
+    {"pin_sense_b", &config_t::pin_sense_b, -1, 31, CONFIG_ADC_PINS},
+    {"batt_divider", &config_t::batt_divider, 1000, 20000},
+    {"batt_nominal_mv", &config_t::batt_nominal_mv, 1000, 20000},
+    {"batt_low_mv", &config_t::batt_low_mv, 0, 20000},
+    {"sense_mohm", &config_t::sense_mohm, 0, 10000},
+    {"current_budget", &config_t::current_budget_ma, 0, 10000},
+};
+static const size_t PARAM_COUNT = sizeof(PARAMS) / sizeof(PARAMS[0]);
+
+static const config_param_t *find_param(const char *key)
+{
+  for (size_t i = 0; i < PARAM_COUNT; i++)
+  {
+    if (strcmp(PARAMS[i].key, key) == 0)
+      return &PARAMS[i];
+  }
+  return nullptr;
+}
+
+/** In range and, for a pin, one the board has. -1 passes where min allows it. */
+static bool valid_value(const config_param_t &p, int32_t value)
+{
+  if (value < p.min || value > p.max)
+    return false;
+  if (!p.pins || value < 0)
+    return true;
+  return (p.pins >> value) & 1;
+}
+
+/** Rules between parameters, checked on the whole candidate config:
+ *  the scan window fits in the scan interval, each supervision timeout
+ *  outlasts (1 + latency) connection intervals twice over as BLE requires,
+ *  no two motor outputs share a GPIO and no ADC input sits on a motor
+ *  output or on another ADC input. Moving a pin onto one in use takes two
+ *  sets, through a free pin.
+ */
+static bool consistent(const config_t &c)
+{
+  if (c.scan_window_ms > c.scan_interval_ms)
+    return false;
+  /** tmo * 10ms > (1 + latency) * itvl * 1.25ms * 2 */
+  if (c.conn_init_tmo * 4 <= c.conn_init_itvl)
+    return false;
+  if (c.conn_tmo * 4 <= (1 + c.conn_latency) * c.conn_itvl)
+    return false;
+
+  const int32_t pins[] = {c.pin_a1, c.pin_a2, c.pin_b1, c.pin_b2,
+                          c.pin_batt, c.pin_sense_a, c.pin_sense_b};
+  const size_t count = sizeof(pins) / sizeof(pins[0]);
+  for (size_t i = 0; i < count; i++)
+  {
+    for (size_t j = i + 1; j < count; j++)
+    {
+      /** -1 is an ADC input that is not wired */
+      if (pins[i] >= 0 && pins[i] == pins[j])
+        return false;
+    }
+  }
+  return true;
+}
+
+void Config_Store::begin(const config_t &defaults)
+{
+  this->defaults = defaults;
+  this->defaults.version = 0;
+  buffers[0] = this->defaults;
+  current.store(&buffers[0], std::memory_order_release);
+  load();
+}
+
+/** Only called from one task at a time (loop) */
+void Config_Store::publish(const config_t &next)
+{
+  config_t *old = current.load(std::memory_order_relaxed);
+  config_t *slot = &buffers[(old - buffers + 1) % 3];
+  *slot = next;
+  slot->version = old->version + 1;
+  current.store(slot, std::memory_order_release);
+  if (changed_function)
+  {
+    (*changed_function)(*old, *slot);
+  }
+}
+
+bool Config_Store::get(const char *key, int32_t &value) const
+{
+  const config_param_t *p = find_param(key);
+  if (!p)
+    return false;
+  value = snapshot()->*(p->field);
+  return true;
+}
+
+bool Config_Store::set(const char *key, int32_t value)
+{
+  const config_param_t *p = find_param(key);
+  if (!p || !valid_value(*p, value))
+    return false;
+  config_t next = *snapshot();
+  if (next.*(p->field) == value)
+    return true;
+  next.*(p->field) = value;
+  if (!consistent(next))
+    return false;
+  publish(next);
+  return true;
+}
+
+bool Config_Store::save()
+{
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, false))
+    return false;
+  const config_t *c = snapshot();
+  for (size_t i = 0; i < PARAM_COUNT; i++)
+  {
+    int32_t value = c->*(PARAMS[i].field);
+    /** Keep flash writes down: only store what differs */
+    if (!prefs.isKey(PARAMS[i].key) || prefs.getInt(PARAMS[i].key) != value)
+      prefs.putInt(PARAMS[i].key, value);
+  }
+  prefs.end();
+  return true;
+}
+
+bool Config_Store::read_saved(config_t &next) const
+{
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, true))
+    return false;
+  next = defaults;
+  for (size_t i = 0; i < PARAM_COUNT; i++)
+  {
+    const config_param_t &p = PARAMS[i];
+    int32_t value = prefs.getInt(p.key, next.*(p.field));
+    if (valid_value(p, value))
+      next.*(p.field) = value;
+  }
+  prefs.end();
+  return true;
+}
+
+bool Config_Store::load()
+{
+  config_t next;
+  if (!read_saved(next) || !consistent(next))
+    return false;
+  publish(next);
+  return true;
+}
+
+void Config_Store::restore_defaults()
+{
+  publish(defaults);
+}
+
+void Config_Store::poll(Stream &stream)
+{
+  while (stream.available())
+  {
+    char c = stream.read();
+    if (c == '\r')
+      continue;
+    if (c == '\n')
+    {
+      line[line_length] = '\0';
+      if (line_length)
+        handle_line(line, stream);
+      line_length = 0;
+    }
+    else if (line_length < sizeof(line) - 1)
+    {
+      line[line_length++] = c;
+    }
+  }
+}
+
+void Config_Store::handle_line(char *text, Print &out)
+{
+  char *save_ptr = nullptr;
+  char *cmd = strtok_r(text, " ", &save_ptr);
+  char *key = strtok_r(nullptr, " ", &save_ptr);
+  char *arg = strtok_r(nullptr, " ", &save_ptr);
+  int32_t value;
+
+  if (!cmd)
+    return;
+  if (strcmp(cmd, "get") == 0 && key)
+  {
+    if (get(key, value))
+      out.printf("%s=%ld\n", key, (long)value);
+    else
+      out.printf("err unknown %s\n", key);
+  }
+  else if (strcmp(cmd, "set") == 0 && key && arg)
+  {
+    char *end;
+    value = strtol(arg, &end, 0);
+    if (*end != '\0')
+      out.printf("err value %s\n", arg);
+    else if (!set(key, value))
+      out.printf("err rejected %s=%s\n", key, arg);
+    else
+      out.printf("ok %s=%ld\n", key, (long)value);
+  }
+  else if (strcmp(cmd, "list") == 0)
+  {
+    const config_t *c = snapshot();
+    for (size_t i = 0; i < PARAM_COUNT; i++)
+    {
+      out.printf("%s=%ld\n", PARAMS[i].key, (long)(c->*(PARAMS[i].field)));
+    }
+    out.printf("version=%lu\n", (unsigned long)c->version);
+  }
+  else if (strcmp(cmd, "save") == 0)
+  {
+    out.println(save() ? "ok saved" : "err save");
+  }
+  else if (strcmp(cmd, "load") == 0)
+  {
+    config_t next;
+    if (!read_saved(next))
+    {
+      out.println("err load");
+    }
+    else if (!consistent(next))
+    {
+      out.println("err rejected");
+    }
+    else
+    {
+      publish(next);
+      out.println("ok loaded");
+    }
+  }
+  else if (strcmp(cmd, "defaults") == 0)
+  {
+    restore_defaults();
+    out.println("ok defaults");
+  }
+  else if (!command_function || !(*command_function)(cmd, key, out))
+  {
+    out.printf("err command %s\n", cmd);
+  }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+
+// GPIOs the pin_* parameters accept, one bit per GPIO. The defaults are the
+// pins the XIAO ESP32-C3 breaks out: GPIO 2-10, 20 and 21. GPIO 11-17 are
+// wired to the SPI flash and 18, 19 to the USB port. Override with -D for
+// another board.
+#ifndef CONFIG_OUTPUT_PINS
+#define CONFIG_OUTPUT_PINS 0x003007FCUL
+#endif
+/** ADC1 only (GPIO 2-4 on the XIAO), ADC2 does not work while the radio is on */
+#ifndef CONFIG_ADC_PINS
+#define CONFIG_ADC_PINS 0x0000001CUL
+#endif
+
+// Every parameter that used to be a compile time constant. All values are
+// int32_t, the unit is in the name or in the comment.
+struct config_t
+{
+  uint32_t version;            /** bumped on every change */
+  int32_t scan_interval_ms;
+  int32_t scan_window_ms;
+  int32_t scan_time_ms;        /** 0 = scan forever */
+  int32_t conn_init_itvl;      /** connect interval, 1.25ms units */
+  int32_t conn_init_tmo;       /** connect supervision timeout, 10ms units */
+  int32_t conn_itvl;           /** interval requested after connect, 1.25ms units */
+  int32_t conn_latency;
+  int32_t conn_tmo;            /** timeout requested after connect, 10ms units */
+  int32_t pwm_limit;           /** max duty, 0..255 */
+  int32_t axis_scale;          /** percent applied to the decoded stick */
+  int32_t pin_a1;
+  int32_t pin_a2;
+  int32_t pin_b1;
+  int32_t pin_b2;
+  int32_t render_delay_us;
+  int32_t max_extrap_us;
+  int32_t link_near_rssi;      /** dBm above which the link goes low latency */
+  int32_t link_far_rssi;       /** dBm below which the link goes long range */
+  int32_t link_sample_ms;      /** RSSI sampling period */
+  int32_t pin_batt;            /** battery divider ADC pin, -1 = not wired */
+  int32_t pin_sense_a;         /** DRV8833 sense resistor ADC pins, -1 = not wired */
+  int32_t pin_sense_b;
+  int32_t batt_divider;        /** battery mV per 1000 ADC mV */
+  int32_t batt_nominal_mv;     /** duty is compensated towards this voltage */
+  int32_t batt_low_mv;
+  int32_t sense_mohm;          /** sense resistor, 0 = no current limiting */
+  int32_t current_budget_ma;   /** both motors together */
+};
+
+typedef void (*config_changed_callback_t)(const config_t &old_config,
+                                          const config_t &new_config);
+/** Handles a command the store does not know, arg may be NULL */
+typedef bool (*config_command_callback_t)(const char *cmd, const char *arg, Print &out);
+
+// Typed, range checked parameters backed by NVS, tunable over a line based
+// serial protocol:
+//   get <key>          -> <key>=<value>
+//   set <key> <value>  -> ok <key>=<value> (live, not saved)
+//   list               -> every <key>=<value>
+//   save | load | defaults
+// Errors reply "err <reason>", "err rejected" for a value out of range or one
+// that conflicts with another parameter. Other commands go to the command
+// callback.
+//
+// Readers never lock: snapshot() returns the current immutable copy, which
+// a writer replaces by publishing a new buffer. Buffers rotate through a
+// ring of three, so a snapshot stays valid for at least two more changes,
+// far longer than one control tick holds it.
+class Config_Store {
+ public:
+    Config_Store() {
+      changed_function = NULL;
+      command_function = NULL;
+      line_length = 0;
+      current.store(&buffers[0]);
+    }
+
+    /** Load saved values over defaults, publish the first snapshot */
+    void begin(const config_t &defaults);
+    const config_t *snapshot() const { return current.load(std::memory_order_acquire); }
+
+    bool get(const char *key, int32_t &value) const;
+    /** Range and cross-field check, publish a new snapshot, false if rejected */
+    bool set(const char *key, int32_t value);
+    bool save();
+    /** Saved values over defaults, false and nothing changes if they do not fit together */
+    bool load();
+    void restore_defaults();
+
+    /** Read pending serial input without blocking, run complete lines */
+    void poll(Stream &stream);
+    void handle_line(char *text, Print &out);
+
+    void set_changed_callback(config_changed_callback_t f) { changed_function = f; }
+    config_changed_callback_t get_changed_callback() { return changed_function; }
+    void set_command_callback(config_command_callback_t f) { command_function = f; }
+    config_command_callback_t get_command_callback() { return command_function; }
+
+ private:
+    void publish(const config_t &next);
+    bool read_saved(config_t &next) const;
+
+    config_t buffers[3];
+    config_t defaults;
+    std::atomic<config_t *> current;
+    config_changed_callback_t changed_function;
+    config_command_callback_t command_function;
+    char line[48];
+    uint8_t line_length;
+};
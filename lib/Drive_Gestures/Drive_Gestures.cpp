@@ -0,0 +1,18 @@
+#include "Drive_Gestures.h"
+
+void load_drive_gestures(Gesture_Engine &gestures, bool relay_select)
+{
+  gestures.add_rule(gesture_chord(MACRO_RECORD_CHORD, true, ACTION_MACRO_RECORD));
+  gestures.add_rule(gesture_chord(MACRO_PLAY_CHORD, true, ACTION_MACRO_PLAY));
+  gestures.add_rule(gesture_on(GESTURE_FLICK(GESTURE_UP), START_BUTTON, ACTION_GEAR_UP));
+  gestures.add_rule(gesture_on(GESTURE_FLICK(GESTURE_DOWN), START_BUTTON, ACTION_GEAR_DOWN));
+  gestures.add_rule(gesture_on(GESTURE_CIRCLE_CW, START_BUTTON, ACTION_GEAR_RESET));
+  gestures.add_rule(gesture_on(GESTURE_CIRCLE_CCW, START_BUTTON, ACTION_GEAR_RESET));
+  gestures.add_rule(gesture_on(GESTURE_HOLD(GESTURE_UP), 0, ACTION_TURBO_ON));
+  gestures.add_rule(gesture_on(GESTURE_CENTRE, 0, ACTION_TURBO_OFF));
+  if (!relay_select)
+    return;
+  /** Every combination of the select bits, all of them = every robot */
+  for (uint8_t target = 1; target <= RELAY_SELECT_MASK; target++)
+    gestures.add_rule(gesture_chord(RELAY_SELECT_BUTTON | target, true, ACTION_RELAY_TARGET, target));
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <Gesture_Engine.h>
+
+// The gesture rules the firmware drives with, shared with Pipeline_Bench so
+// the benchmark loads the same table. Rules match on the gamepad's button
+// byte, pData[5] of the notification (joystick_t::accel), not on
+// joystick_t::buttons.
+
+// Gamepad buttons, bits of the pData[5] byte
+#define START_BUTTON 0x08
+#define MACRO_RECORD_CHORD 0x18          /** start + 0x10: start or end a recording */
+#define MACRO_PLAY_CHORD 0x28            /** start + 0x20: play or stop the recording */
+#define RELAY_SELECT_BUTTON START_BUTTON /** hold start and press... */
+#define RELAY_SELECT_MASK 0x07           /** ...these bits to pick a robot, all of them = every robot */
+
+// What the gesture rules trigger
+enum GESTURE_ACTIONS {
+  ACTION_MACRO_RECORD = 0,
+  ACTION_MACRO_PLAY,
+  ACTION_GEAR_UP,
+  ACTION_GEAR_DOWN,
+  ACTION_GEAR_RESET,
+  ACTION_TURBO_ON,
+  ACTION_TURBO_OFF,
+  ACTION_RELAY_TARGET /** arg: the target */
+};
+
+/** Add the drive rules to gestures, relay_select adds the relay target chords */
+void load_drive_gestures(Gesture_Engine &gestures, bool relay_select);
@@ -0,0 +1,99 @@
+#include "Drive_Macro.h"
+#include <Preferences.h>
+
+static const char NVS_NAMESPACE[] = "macro";
+static const char NVS_KEY[] = "take";
+
+static void macroTimerCB(void *arg)
+{
+  ((Drive_Macro *)arg)->on_timer();
+}
+
+bool Drive_Macro::start_recording(uint32_t t_us)
+{
+  if (playing)
+    return false;
+  recorder.start(t_us);
+  return true;
+}
+
+bool Drive_Macro::play()
+{
+  if (recorder.is_recording() || playing || recorder.get_frames() == 0)
+    return false;
+  if (!timer)
+  {
+    const esp_timer_create_args_t args = {
+        .callback = &macroTimerCB,
+        .arg = this,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "macro",
+    };
+    if (esp_timer_create(&args, &timer) != ESP_OK)
+      return false;
+  }
+  reader.reset(buffer, recorder.get_length());
+  play_start_us = esp_timer_get_time();
+  playing = true;
+  return schedule_next();
+}
+
+void Drive_Macro::stop(bool notify)
+{
+  if (!playing)
+    return;
+  esp_timer_stop(timer);
+  playing = false;
+  if (notify && frame_function)
+    (*frame_function)(0, 0);
+}
+
+/** Decode the next frame and arm the timer for it */
+bool Drive_Macro::schedule_next()
+{
+  uint32_t at_us;
+  if (!reader.next(at_us, play_x, play_y, play_changed))
+  {
+    stop();
+    return false;
+  }
+  /** Absolute deadlines, so timer latency does not accumulate */
+  play_due_us = play_start_us + at_us;
+  int64_t delay = play_due_us - esp_timer_get_time();
+  esp_timer_start_once(timer, delay > 0 ? delay : 0);
+  return true;
+}
+
+void Drive_Macro::on_timer()
+{
+  if (!playing)
+    return;
+  if (frame_function && play_changed)
+    (*frame_function)(play_x, play_y);
+  schedule_next();
+}
+
+bool Drive_Macro::save()
+{
+  if (recorder.is_recording())
+    return false;
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, false))
+    return false;
+  size_t length = recorder.get_length();
+  bool ok = prefs.putBytes(NVS_KEY, buffer, length) == length;
+  prefs.end();
+  return ok;
+}
+
+bool Drive_Macro::load()
+{
+  if (recorder.is_recording() || playing)
+    return false;
+  Preferences prefs;
+  if (!prefs.begin(NVS_NAMESPACE, true))
+    return false;
+  size_t length = prefs.getBytes(NVS_KEY, buffer, sizeof(buffer));
+  prefs.end();
+  return recorder.restore(length);
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+#include <Macro_Codec.h>
+
+#define MACRO_BUFFER_SIZE 4096
+
+typedef void (*macro_frame_callback_t)(int x, int y);
+
+// Records the decoded stick setpoint with microsecond timestamps and plays
+// it back from an esp_timer, so replay timing does not depend on loop().
+//
+// Recording is Macro_Recorder's, a typical frame at a 15ms interval takes
+// 4-5 bytes. When the buffer fills up the take is closed at that point and
+// the recorder goes full: is_recording() is false, and the next
+// stop_recording() only acknowledges it, so the take is not lost to a fresh
+// start_recording().
+class Drive_Macro {
+ public:
+    Drive_Macro() : recorder(buffer, sizeof(buffer)) {
+      frame_function = NULL;
+      timer = nullptr;
+      playing = false;
+    }
+
+    /** t_us: stamp of the input that started it, on the same clock as record() */
+    bool start_recording(uint32_t t_us);
+    /** Append a frame. false once, when the buffer filled and closed the take. */
+    bool record(uint32_t t_us, int x, int y) { return recorder.record(t_us, x, y); }
+    /** Ends the take, the last setpoint is held until t_us on playback.
+     *  After the buffer filled it only clears the full state. */
+    void stop_recording(uint32_t t_us) { recorder.stop(t_us); }
+
+    /** Starts replaying, the callback runs in the esp_timer task */
+    bool play();
+    /** Stops playback. The callback gets a final 0, 0 unless live input
+     *  takes over (notify false). */
+    void stop(bool notify = true);
+
+    bool is_recording() { return recorder.is_recording(); }
+    /** The buffer filled, the take is closed but not yet acknowledged */
+    bool is_full() { return recorder.is_full(); }
+    bool is_playing() { return playing; }
+    size_t get_size() { return recorder.get_length(); }
+    uint16_t get_frames() { return recorder.get_frames(); }
+    uint32_t get_duration_us() { return recorder.get_duration_us(); }
+
+    /** Keep the take in NVS across resets */
+    bool save();
+    bool load();
+
+    void set_frame_callback(macro_frame_callback_t f) { frame_function = f; }
+    macro_frame_callback_t get_frame_callback() { return frame_function; }
+
+    /** Playback step, public for the C timer callback */
+    void on_timer();
+
+ private:
+    bool schedule_next();
+
+    macro_frame_callback_t frame_function;
+    esp_timer_handle_t timer;
+    uint8_t buffer[MACRO_BUFFER_SIZE];
+    Macro_Recorder recorder;
+    volatile bool playing;
+
+    /** Playback state */
+    Macro_Reader reader;
+    int64_t play_start_us;
+    int64_t play_due_us;
+    int play_x, play_y;     /** decoded, due at play_due_us */
+    bool play_changed;
+};
@@ -0,0 +1,11 @@
+#include "Drive_Mixer.h"
+
+void mix_drive(int x, int y, int &left, int &right, int limit)
+{
+  left = y + x;
+  right = y - x;
+  left = left > limit ? limit : left;
+  left = left < -limit ? -limit : left;
+  right = right > limit ? limit : right;
+  right = right < -limit ? -limit : right;
+}
@@ -0,0 +1,4 @@
+#pragma once
+
+/** Arcade drive: y is throttle, x is steering, outputs are -limit..limit duty */
+void mix_drive(int x, int y, int &left, int &right, int limit = 255);
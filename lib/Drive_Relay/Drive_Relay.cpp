@@ -0,0 +1,85 @@
+#include "Drive_Relay.h"
+#include <WiFi.h>
+#include <esp_now.h>
+
+static const uint8_t BROADCAST_ADDR[ESP_NOW_ETH_ALEN] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+static Drive_Relay *active_relay = nullptr;
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+static void espNowRecvCB(const esp_now_recv_info_t *info, const uint8_t *data, int length)
+#else
+static void espNowRecvCB(const uint8_t *mac, const uint8_t *data, int length)
+#endif
+{
+  if (active_relay)
+  {
+    active_relay->on_receive(data, length);
+  }
+}
+
+bool Drive_Relay::begin()
+{
+  send_lock = xSemaphoreCreateMutex();
+  /** ESP-NOW needs the radio in station mode, no access point is joined */
+  WiFi.mode(WIFI_STA);
+  if (esp_now_init() != ESP_OK)
+  {
+    Serial.println("ESP-NOW init failed");
+    return false;
+  }
+
+  esp_now_peer_info_t peer = {};
+  memcpy(peer.peer_addr, BROADCAST_ADDR, ESP_NOW_ETH_ALEN);
+  peer.channel = 0; /** current channel */
+  peer.encrypt = false;
+  if (esp_now_add_peer(&peer) != ESP_OK)
+  {
+    Serial.println("ESP-NOW add broadcast peer failed");
+    return false;
+  }
+
+  active_relay = this;
+  esp_now_register_recv_cb(espNowRecvCB);
+  return true;
+}
+
+bool Drive_Relay::send(uint8_t target, int x, int y, uint8_t flags)
+{
+  if (!send_lock)
+    return false;
+  /** One sender at a time, or two tasks could share a sequence number and
+   *  receivers would drop the second frame as a duplicate.
+   */
+  xSemaphoreTake(send_lock, portMAX_DELAY);
+  drive_frame_t frame;
+  make_frame(frame, target, ++seq, x, y, flags);
+  last_sent = frame;
+  last_frame_ms = millis();
+  bool ok = esp_now_send(BROADCAST_ADDR, (const uint8_t *)&frame, sizeof(frame)) == ESP_OK;
+  xSemaphoreGive(send_lock);
+  return ok;
+}
+
+bool Drive_Relay::keepalive()
+{
+  if (!send_lock)
+    return false;
+  xSemaphoreTake(send_lock, portMAX_DELAY);
+  drive_frame_t frame = last_sent;
+  xSemaphoreGive(send_lock);
+  return send(frame.target, frame.x, frame.y, frame.flags);
+}
+
+/** Runs in the WiFi task */
+void Drive_Relay::on_receive(const uint8_t *data, int length)
+{
+  drive_frame_t frame;
+  if (!filter.accept(data, length, millis(), frame))
+    return;
+  last_frame_ms = filter.get_last_frame_ms();
+
+  if (frame_function)
+  {
+    (*frame_function)(frame);
+  }
+}
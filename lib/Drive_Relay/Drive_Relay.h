@@ -0,0 +1,52 @@
+#pragma once
+
+#include <Arduino.h>
+#include <Relay_Frame.h>
+
+// Relay roles, select one with -D RELAY_MODE=...
+#define RELAY_OFF 0      /** plain one gamepad, one robot */
+#define RELAY_SENDER 1   /** holds the HID connection and rebroadcasts */
+#define RELAY_RECEIVER 2 /** no BLE, driven by a sender over ESP-NOW */
+
+typedef void (*relay_frame_callback_t)(const drive_frame_t &frame);
+
+// Fans decoded drive commands out to several robots with one ESP-NOW
+// broadcast per frame, so added latency does not grow with the fleet.
+// Only one instance can be active, ESP-NOW has a single receive callback.
+class Drive_Relay {
+ public:
+    Drive_Relay() {
+      frame_function = NULL;
+      send_lock = NULL;
+      seq = 0;
+      last_frame_ms = 0;
+      memset(&last_sent, 0, sizeof(last_sent));
+    }
+
+    bool begin();
+    /** Broadcast a new frame, sequence numbers are assigned here. Safe from any task. */
+    bool send(uint8_t target, int x, int y, uint8_t flags = 0);
+    /** Repeat the last frame with a fresh sequence number. */
+    bool keepalive();
+    /** Receiver address, frames for other robots are dropped. */
+    void set_address(uint8_t a) { filter.set_address(a); }
+    uint8_t get_address() { return filter.get_address(); }
+    void set_frame_callback(relay_frame_callback_t f) { frame_function = f; }
+    relay_frame_callback_t get_frame_callback() { return frame_function; }
+    /** millis() of the last accepted (receiver) or sent (sender) frame */
+    uint32_t get_last_frame_ms() { return last_frame_ms; }
+    uint32_t get_received() { return filter.get_received(); }
+    /** Frames skipped in the sequence, counted on the receiver */
+    uint32_t get_lost() { return filter.get_lost(); }
+
+    void on_receive(const uint8_t *data, int length);
+
+ private:
+    relay_frame_callback_t frame_function;
+    Relay_Filter filter;
+    /** send() runs from loop(), the BLE task and the esp_timer task */
+    SemaphoreHandle_t send_lock;
+    uint16_t seq;
+    volatile uint32_t last_frame_ms;
+    drive_frame_t last_sent;
+};
@@ -0,0 +1,234 @@
+#include "Gesture_Engine.h"
+#include <string.h>
+
+void Gesture_Engine::clear()
+{
+  rule_count = 0;
+  memset(starts, 0, sizeof(starts));
+  reset();
+}
+
+int Gesture_Engine::add_rule(const gesture_rule_t &rule)
+{
+  if (rule_count >= GESTURE_MAX_RULES || rule.count == 0 || rule.count > GESTURE_MAX_STEPS)
+    return -1;
+  for (uint8_t i = 0; i < rule.count; i++)
+  {
+    const gesture_step_t &s = rule.steps[i];
+    if (s.symbol == GESTURE_PRESS_ANY ? s.held == 0 : s.symbol >= GESTURE_SYMBOLS)
+      return -1;
+  }
+
+  int r = rule_count++;
+  rules[r] = rule;
+  const gesture_step_t &first = rule.steps[0];
+  if (first.symbol != GESTURE_PRESS_ANY)
+  {
+    starts[first.symbol] |= 1UL << r;
+    return r;
+  }
+  /** A chord can be completed by any of its buttons */
+  for (int i = 0; i < 16; i++)
+  {
+    if (first.held & (1 << i))
+      starts[GESTURE_PRESS(i)] |= 1UL << r;
+  }
+  return r;
+}
+
+void Gesture_Engine::reset()
+{
+  active = 0;
+  buttons = 0;
+  pressed = 0;
+  zone = ZONE_CENTRE;
+  dir = -1;
+  flick_dir = -1;
+  leave_ms = 0;
+  rim_ms = 0;
+  hold_fired = false;
+  circle_steps = 0;
+  circle_start_ms = 0;
+}
+
+void Gesture_Engine::update(uint32_t now_ms, uint16_t new_buttons, int x, int y)
+{
+  uint16_t changed = buttons ^ new_buttons;
+  /** matches() looks at the buttons as they are now */
+  buttons = new_buttons;
+  pressed = changed & new_buttons;
+  while (changed)
+  {
+    int i = __builtin_ctz(changed);
+    changed &= changed - 1;
+    feed(new_buttons & (1 << i) ? GESTURE_PRESS(i) : GESTURE_RELEASE(i), now_ms);
+  }
+  pressed = 0;
+
+  track_stick(now_ms, x, y);
+  check_hold(now_ms);
+}
+
+void Gesture_Engine::tick(uint32_t now_ms)
+{
+  for (uint32_t pending = active; pending; pending &= pending - 1)
+  {
+    int r = __builtin_ctz(pending);
+    if (now_ms - step_ms[r] > rules[r].timeout_ms)
+      active &= ~(1UL << r);
+  }
+  check_hold(now_ms);
+}
+
+bool Gesture_Engine::matches(const gesture_step_t &s, uint8_t symbol) const
+{
+  if (s.symbol == GESTURE_PRESS_ANY)
+  {
+    /** Two of the buttons may arrive in one report, only the first completes the chord */
+    uint16_t completing = s.held & pressed;
+    if (!completing || symbol != GESTURE_PRESS(__builtin_ctz(completing)))
+      return false;
+  }
+  else if (s.symbol != symbol)
+  {
+    return false;
+  }
+  if (s.flags & GESTURE_EXACT)
+    return buttons == s.held;
+  return (buttons & s.held) == s.held;
+}
+
+void Gesture_Engine::feed(uint8_t symbol, uint32_t now_ms)
+{
+  uint32_t done = 0;
+  for (uint32_t pending = active; pending; pending &= pending - 1)
+  {
+    int r = __builtin_ctz(pending);
+    uint32_t bit = 1UL << r;
+    const gesture_rule_t &rule = rules[r];
+    if (now_ms - step_ms[r] > rule.timeout_ms)
+    {
+      active &= ~bit;
+      continue;
+    }
+    if (matches(rule.steps[step[r]], symbol))
+    {
+      step_ms[r] = now_ms;
+      if (++step[r] < rule.count)
+        continue;
+      active &= ~bit;
+      done |= bit;
+      if (action_function)
+        (*action_function)(rule.action, rule.arg);
+    }
+    else if (symbol < GESTURE_RELEASE(0))
+    {
+      /** Another button broke the sequence */
+      active &= ~bit;
+    }
+  }
+
+  /** A rule that just completed does not start over on the same symbol */
+  for (uint32_t pending = starts[symbol] & ~active & ~done; pending; pending &= pending - 1)
+  {
+    int r = __builtin_ctz(pending);
+    const gesture_rule_t &rule = rules[r];
+    if (!matches(rule.steps[0], symbol))
+      continue;
+    if (rule.count == 1)
+    {
+      if (action_function)
+        (*action_function)(rule.action, rule.arg);
+      continue;
+    }
+    active |= 1UL << r;
+    step[r] = 1;
+    step_ms[r] = now_ms;
+  }
+}
+
+int Gesture_Engine::direction(int x, int y)
+{
+  int ax = x < 0 ? -x : x;
+  int ay = y < 0 ? -y : y;
+  /** 45 degree sectors centred on the axes, tan(22.5) ~ 106 / 256 */
+  if (ax * 256 < ay * 106)
+    return y > 0 ? GESTURE_UP : GESTURE_DOWN;
+  if (ay * 256 < ax * 106)
+    return x > 0 ? GESTURE_LEFT : GESTURE_RIGHT;
+  if (y > 0)
+    return x > 0 ? GESTURE_UP_LEFT : GESTURE_UP_RIGHT;
+  return x > 0 ? GESTURE_DOWN_LEFT : GESTURE_DOWN_RIGHT;
+}
+
+void Gesture_Engine::track_stick(uint32_t now_ms, int x, int y)
+{
+  int r2 = x * x + y * y;
+  if (r2 <= centre * centre)
+  {
+    if (zone == ZONE_CENTRE)
+      return;
+    if (flick_dir >= 0 && now_ms - leave_ms <= flick_ms)
+      feed(GESTURE_FLICK(flick_dir), now_ms);
+    zone = ZONE_CENTRE;
+    dir = -1;
+    circle_steps = 0;
+    feed(GESTURE_CENTRE, now_ms);
+    return;
+  }
+
+  if (zone == ZONE_CENTRE)
+  {
+    zone = ZONE_MID;
+    leave_ms = now_ms;
+    flick_dir = -1;
+  }
+  /** Between centre and rim nothing changes, that is the hysteresis */
+  if (r2 < rim * rim)
+    return;
+
+  int d = direction(x, y);
+  if (zone != ZONE_RIM)
+  {
+    zone = ZONE_RIM;
+    if (flick_dir < 0)
+      flick_dir = d;
+    circle_steps = 0;
+    circle_start_ms = now_ms;
+  }
+  else if (d == dir)
+  {
+    return;
+  }
+  else
+  {
+    /** Shortest way round, jitter on a sector boundary cancels out */
+    int turn = (d - dir + 8) % 8;
+    turn = turn > 4 ? turn - 8 : turn;
+    if (now_ms - circle_start_ms > circle_ms)
+    {
+      circle_steps = 0;
+      circle_start_ms = now_ms;
+    }
+    circle_steps += turn;
+  }
+  dir = d;
+  rim_ms = now_ms;
+  hold_fired = false;
+  feed(GESTURE_DIR(d), now_ms);
+
+  if (circle_steps >= 8 || circle_steps <= -8)
+  {
+    feed(circle_steps > 0 ? GESTURE_CIRCLE_CCW : GESTURE_CIRCLE_CW, now_ms);
+    circle_steps = 0;
+    circle_start_ms = now_ms;
+  }
+}
+
+void Gesture_Engine::check_hold(uint32_t now_ms)
+{
+  if (zone != ZONE_RIM || hold_fired || now_ms - rim_ms < hold_ms)
+    return;
+  hold_fired = true;
+  feed(GESTURE_HOLD(dir), now_ms);
+}
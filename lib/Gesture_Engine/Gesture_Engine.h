@@ -0,0 +1,169 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Stick directions, counterclockwise from up. Up and left are positive,
+// like decode_axis().
+enum GESTURE_DIRS {
+  GESTURE_UP = 0,
+  GESTURE_UP_LEFT,
+  GESTURE_LEFT,
+  GESTURE_DOWN_LEFT,
+  GESTURE_DOWN,
+  GESTURE_DOWN_RIGHT,
+  GESTURE_RIGHT,
+  GESTURE_UP_RIGHT
+};
+
+// Symbols the report stream is turned into, rule steps match on these
+#define GESTURE_PRESS(button) (button)          /** 0..15 */
+#define GESTURE_RELEASE(button) (16 + (button)) /** 16..31 */
+#define GESTURE_DIR(dir) (32 + (dir))           /** stick reached the rim in dir */
+#define GESTURE_CENTRE 40                       /** stick back in the centre */
+#define GESTURE_FLICK(dir) (41 + (dir))         /** out to the rim and back, quickly */
+#define GESTURE_HOLD(dir) (49 + (dir))          /** kept at the rim in dir */
+#define GESTURE_CIRCLE_CCW 57                   /** a full turn along the rim */
+#define GESTURE_CIRCLE_CW 58
+#define GESTURE_SYMBOLS 59
+#define GESTURE_PRESS_ANY 0xFF /** step only: the press that completes the held chord */
+
+#define GESTURE_MAX_RULES 32
+#define GESTURE_MAX_STEPS 4
+#define GESTURE_EXACT 0x01 /** step flag: no buttons down besides held */
+
+typedef struct
+{
+  uint8_t symbol;
+  uint8_t flags;
+  uint16_t held; /** buttons that must be down when symbol arrives */
+} gesture_step_t;
+
+typedef struct
+{
+  gesture_step_t steps[GESTURE_MAX_STEPS];
+  uint8_t count;
+  uint8_t action;
+  uint8_t arg;
+  uint16_t timeout_ms; /** longest gap between two steps */
+} gesture_rule_t;
+
+typedef void (*gesture_action_callback_t)(uint8_t action, uint8_t arg);
+
+/** Buttons pressed together, in any order. Fires once, on the press that completes them. */
+static inline gesture_rule_t gesture_chord(uint16_t held, bool exact, uint8_t action, uint8_t arg = 0)
+{
+  gesture_rule_t rule = {};
+  rule.steps[0] = {GESTURE_PRESS_ANY, (uint8_t)(exact ? GESTURE_EXACT : 0), held};
+  rule.count = 1;
+  rule.action = action;
+  rule.arg = arg;
+  return rule;
+}
+
+/** A single symbol, with held buttons down */
+static inline gesture_rule_t gesture_on(uint8_t symbol, uint16_t held, uint8_t action, uint8_t arg = 0)
+{
+  gesture_rule_t rule = {};
+  rule.steps[0] = {symbol, 0, held};
+  rule.count = 1;
+  rule.action = action;
+  rule.arg = arg;
+  return rule;
+}
+
+/** Symbols one after the other, at most timeout_ms apart. A stray button press starts over. */
+static inline gesture_rule_t gesture_sequence(const uint8_t *symbols, uint8_t count, uint16_t timeout_ms,
+                                              uint8_t action, uint8_t arg = 0)
+{
+  gesture_rule_t rule = {};
+  rule.count = count > GESTURE_MAX_STEPS ? GESTURE_MAX_STEPS : count;
+  for (uint8_t i = 0; i < rule.count; i++)
+    rule.steps[i] = {symbols[i], 0, 0};
+  rule.timeout_ms = timeout_ms;
+  rule.action = action;
+  rule.arg = arg;
+  return rule;
+}
+
+// Recognizes chords, sequences and stick gestures on the decoded report
+// stream and calls the action callback for each rule that completes.
+//
+// Reports become symbols: button edges, stick direction changes at the rim,
+// flicks, holds and full circles. Every rule is a short list of steps.
+// add_rule() files it in a per-symbol table of the rules its first step can
+// start on, so a symbol only visits the rules already under way plus the
+// ones it can start: O(active rules), however many are loaded.
+//
+// Not thread safe, feed it from one task.
+class Gesture_Engine {
+ public:
+    Gesture_Engine() {
+      action_function = NULL;
+      centre = 80;
+      rim = 200;
+      flick_ms = 250;
+      hold_ms = 600;
+      circle_ms = 1500;
+      clear();
+    }
+
+    /** Drop every rule */
+    void clear();
+    /** Index of the rule, -1 when full or malformed */
+    int add_rule(const gesture_rule_t &rule);
+    int get_rule_count() { return rule_count; }
+
+    /** One decoded report, buttons as a bitmap and the stick in -255..255 */
+    void update(uint32_t now_ms, uint16_t buttons, int x, int y);
+    /** Holds and timeouts while no reports arrive, call from loop() */
+    void tick(uint32_t now_ms);
+    /** Forget buttons, stick and partial matches, the rules stay */
+    void reset();
+
+    void set_action_callback(gesture_action_callback_t f) { action_function = f; }
+    /** Stick radius for the centre and the rim, anything between keeps the last state */
+    void set_stick(int centre_radius, int rim_radius) {
+      centre = centre_radius;
+      rim = rim_radius;
+    }
+    /** Longest flick, shortest hold, longest full circle */
+    void set_timing(uint16_t flick, uint16_t hold, uint16_t circle) {
+      flick_ms = flick;
+      hold_ms = hold;
+      circle_ms = circle;
+    }
+    uint16_t get_buttons() { return buttons; }
+    /** GESTURE_DIRS at the rim, -1 otherwise */
+    int get_direction() { return zone == ZONE_RIM ? dir : -1; }
+
+ private:
+    enum { ZONE_CENTRE, ZONE_MID, ZONE_RIM };
+
+    void feed(uint8_t symbol, uint32_t now_ms);
+    void track_stick(uint32_t now_ms, int x, int y);
+    void check_hold(uint32_t now_ms);
+    bool matches(const gesture_step_t &step, uint8_t symbol) const;
+    static int direction(int x, int y);
+
+    gesture_rule_t rules[GESTURE_MAX_RULES];
+    uint8_t rule_count;
+    uint32_t starts[GESTURE_SYMBOLS]; /** rules whose first step can match each symbol */
+    uint32_t active;                  /** rules part way through */
+    uint8_t step[GESTURE_MAX_RULES];
+    uint32_t step_ms[GESTURE_MAX_RULES];
+    gesture_action_callback_t action_function;
+
+    uint16_t buttons;
+    uint16_t pressed; /** pressed in the report being fed */
+    int centre, rim;
+    uint16_t flick_ms, hold_ms, circle_ms;
+    uint8_t zone;
+    int dir;
+    int flick_dir; /** first direction reached since leaving the centre */
+    uint32_t leave_ms;
+    uint32_t rim_ms;
+    bool hold_fired;
+    int circle_steps; /** eighths of a turn, counterclockwise positive */
+    uint32_t circle_start_ms;
+};
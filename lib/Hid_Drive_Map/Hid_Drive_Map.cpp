@@ -0,0 +1,114 @@
+#include "Hid_Drive_Map.h"
+#include <string.h>
+
+// HID keyboard usages, Usage Page 0x07
+static const uint8_t KEY_A = 0x04;
+static const uint8_t KEY_D = 0x07;
+static const uint8_t KEY_S = 0x16;
+static const uint8_t KEY_W = 0x1A;
+static const uint8_t KEY_ESCAPE = 0x29;
+static const uint8_t KEY_SPACE = 0x2C;
+static const uint8_t KEY_PAGE_UP = 0x4B;
+static const uint8_t KEY_PAGE_DOWN = 0x4E;
+static const uint8_t KEY_RIGHT = 0x4F;
+static const uint8_t KEY_LEFT = 0x50;
+static const uint8_t KEY_DOWN = 0x51;
+static const uint8_t KEY_UP = 0x52;
+static const uint8_t KEY_LEFT_SHIFT = 0xE1;
+static const uint8_t KEY_RIGHT_SHIFT = 0xE5;
+static const uint8_t KEY_MODIFIER_BASE = 0xE0;
+static const uint8_t MOUSE_RIGHT_BUTTON = 0x02;
+
+static int clamp_axis(int v)
+{
+  return v > 255 ? 255 : v < -255 ? -255 : v;
+}
+
+void Hid_Drive_Map::load_default_keymap()
+{
+  memset(key_actions, 0, sizeof(key_actions));
+  key_actions[KEY_W] = DRIVE_FORWARD;
+  key_actions[KEY_UP] = DRIVE_FORWARD;
+  key_actions[KEY_PAGE_UP] = DRIVE_FORWARD;
+  key_actions[KEY_S] = DRIVE_BACK;
+  key_actions[KEY_DOWN] = DRIVE_BACK;
+  key_actions[KEY_PAGE_DOWN] = DRIVE_BACK;
+  key_actions[KEY_A] = DRIVE_LEFT;
+  key_actions[KEY_LEFT] = DRIVE_LEFT;
+  key_actions[KEY_D] = DRIVE_RIGHT;
+  key_actions[KEY_RIGHT] = DRIVE_RIGHT;
+  key_actions[KEY_LEFT_SHIFT] = DRIVE_BOOST;
+  key_actions[KEY_RIGHT_SHIFT] = DRIVE_BOOST;
+  key_actions[KEY_SPACE] = DRIVE_STOP;
+  key_actions[KEY_ESCAPE] = DRIVE_STOP;
+}
+
+bool Hid_Drive_Map::set_setpoint(int new_x, int new_y)
+{
+  if (new_x == x && new_y == y)
+    return false;
+  x = new_x;
+  y = new_y;
+  return true;
+}
+
+bool Hid_Drive_Map::on_keyboard(const uint8_t *data, size_t length)
+{
+  if (length < sizeof(boot_keyboard_t))
+    return false;
+  const boot_keyboard_t *report = (const boot_keyboard_t *)data;
+
+  uint8_t actions = 0;
+  uint8_t modifiers = report->modifiers;
+  for (uint8_t i = 0; modifiers; i++, modifiers >>= 1)
+  {
+    if (modifiers & 1)
+      actions |= key_actions[KEY_MODIFIER_BASE + i];
+  }
+  for (size_t i = 0; i < sizeof(report->keys); i++)
+  {
+    actions |= key_actions[report->keys[i]];
+  }
+
+  if (actions & DRIVE_STOP)
+    return set_setpoint(0, 0);
+  int s = (actions & DRIVE_BOOST) ? boost_speed : speed;
+  int new_y = ((actions & DRIVE_FORWARD) ? s : 0) - ((actions & DRIVE_BACK) ? s : 0);
+  int new_x = ((actions & DRIVE_LEFT) ? s : 0) - ((actions & DRIVE_RIGHT) ? s : 0);
+  return set_setpoint(new_x, new_y);
+}
+
+bool Hid_Drive_Map::on_mouse(const uint8_t *data, size_t length)
+{
+  if (length < sizeof(boot_mouse_t))
+    return false;
+  const boot_mouse_t *report = (const boot_mouse_t *)data;
+
+  if (report->buttons & MOUSE_RIGHT_BUTTON)
+  {
+    mouse_x = 0;
+    mouse_y = 0;
+  }
+  else
+  {
+    /** Mouse right and towards the user are positive, the setpoint is not */
+    mouse_x = clamp_axis(mouse_x - report->dx * mouse_gain);
+    mouse_y = clamp_axis(mouse_y - report->dy * mouse_gain);
+  }
+  return set_setpoint(mouse_x, mouse_y);
+}
+
+bool Hid_Drive_Map::tick(uint32_t now_ms)
+{
+  uint32_t elapsed = now_ms - last_tick_ms;
+  int step = (int)(elapsed * mouse_decay_per_s / 1000);
+  if (step == 0)
+    return false;
+  last_tick_ms = now_ms;
+  if (mouse_x == 0 && mouse_y == 0)
+    return false;
+
+  mouse_x = mouse_x > step ? mouse_x - step : mouse_x < -step ? mouse_x + step : 0;
+  mouse_y = mouse_y > step ? mouse_y - step : mouse_y < -step ? mouse_y + step : 0;
+  return set_setpoint(mouse_x, mouse_y);
+}
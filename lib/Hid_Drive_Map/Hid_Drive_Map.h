@@ -0,0 +1,86 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Drive actions a key can be bound to, keys may combine several
+enum DRIVE_ACTIONS {
+  DRIVE_FORWARD = 0x01,
+  DRIVE_BACK = 0x02,
+  DRIVE_LEFT = 0x04,
+  DRIVE_RIGHT = 0x08,
+  DRIVE_BOOST = 0x10,
+  DRIVE_STOP = 0x20
+};
+
+// Boot protocol report layouts (HID 1.11 appendix B)
+typedef struct __attribute__((__packed__))
+{
+  uint8_t modifiers;
+  uint8_t reserved;
+  uint8_t keys[6];
+} boot_keyboard_t;
+
+typedef struct __attribute__((__packed__))
+{
+  uint8_t buttons;
+  int8_t dx;
+  int8_t dy;
+} boot_mouse_t;
+
+// Turns keyboard, presenter and mouse reports into the same x, y setpoint
+// a gamepad stick produces (-255..255, forward and left positive).
+//
+// Keys go through a 256 entry usage -> action table, modifiers are looked
+// up as their usages 0xE0..0xE7, so a report costs at most 14 table reads.
+// The mouse acts as a virtual stick: motion moves the setpoint, which
+// springs back to centre over time and is recentred by the right button.
+class Hid_Drive_Map {
+ public:
+    Hid_Drive_Map() {
+      speed = 160;
+      boost_speed = 255;
+      mouse_gain = 4;
+      mouse_decay_per_s = 255;
+      x = y = 0;
+      mouse_x = mouse_y = 0;
+      last_tick_ms = 0;
+      load_default_keymap();
+    }
+
+    /** WASD, arrows, PageUp/PageDown for presenters, shift boosts, space and escape stop */
+    void load_default_keymap();
+    void bind(uint8_t usage, uint8_t actions) { key_actions[usage] = actions; }
+    uint8_t get_binding(uint8_t usage) { return key_actions[usage]; }
+
+    /** Returns true when the setpoint changed */
+    bool on_keyboard(const uint8_t *data, size_t length);
+    bool on_mouse(const uint8_t *data, size_t length);
+    /** Spring the mouse setpoint back, call from loop(). True on change. */
+    bool tick(uint32_t now_ms);
+    void reset() { x = y = mouse_x = mouse_y = 0; }
+
+    int get_x() { return x; }
+    int get_y() { return y; }
+
+    void set_speed(int normal, int boost) {
+      speed = normal;
+      boost_speed = boost;
+    }
+    void set_mouse(int gain, int decay_per_s) {
+      mouse_gain = gain;
+      mouse_decay_per_s = decay_per_s;
+    }
+
+ private:
+    bool set_setpoint(int new_x, int new_y);
+
+    uint8_t key_actions[256];
+    int speed;
+    int boost_speed;
+    int mouse_gain;
+    int mouse_decay_per_s;
+    int x, y;
+    int mouse_x, mouse_y;
+    uint32_t last_tick_ms;
+};
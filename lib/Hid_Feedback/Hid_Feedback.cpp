@@ -0,0 +1,70 @@
+#include "Hid_Feedback.h"
+#include <string.h>
+
+bool Hid_Feedback::queue(uint8_t kind, const uint8_t *data, size_t length)
+{
+  if (kind >= FEEDBACK_KINDS || length == 0 || length > FEEDBACK_MAX_PAYLOAD)
+    return false;
+  if (pending_length[kind])
+    coalesced++;
+  memcpy(pending[kind], data, length);
+  pending_length[kind] = length;
+  return true;
+}
+
+bool Hid_Feedback::rumble(uint8_t strength, uint16_t duration_ms)
+{
+  /** Xbox style rumble output report: enable mask, left trigger, right
+   *  trigger, strong and weak motor 0..100, duration, start delay and loop
+   *  count, times in 10ms units.
+   */
+  uint16_t duration = duration_ms / 10;
+  uint8_t report[FEEDBACK_RUMBLE_SIZE] = {0x03, 0, 0, strength, strength,
+                                          (uint8_t)(duration > 255 ? 255 : duration), 0, 0};
+  return queue(FEEDBACK_RUMBLE, report, sizeof(report));
+}
+
+bool Hid_Feedback::leds(uint8_t bits)
+{
+  return queue(FEEDBACK_LED, &bits, 1);
+}
+
+bool Hid_Feedback::pump(uint32_t now_us)
+{
+  if (!write_function || (written + failed && now_us - last_write_us < interval_us))
+    return false;
+
+  uint8_t data[FEEDBACK_MAX_PAYLOAD];
+  uint8_t kind = FEEDBACK_KINDS;
+  uint8_t length = 0;
+  /** Round robin, so a chatty kind can not starve the other */
+  for (uint8_t i = 0; i < FEEDBACK_KINDS; i++)
+  {
+    uint8_t k = (next_kind + i) % FEEDBACK_KINDS;
+    if (pending_length[k])
+    {
+      kind = k;
+      length = pending_length[k];
+      memcpy(data, pending[k], length);
+      pending_length[k] = 0;
+      next_kind = (k + 1) % FEEDBACK_KINDS;
+      break;
+    }
+  }
+  if (kind == FEEDBACK_KINDS)
+    return false;
+
+  last_write_us = now_us;
+  if (!(*write_function)(kind, data, length))
+  {
+    failed++;
+    return false;
+  }
+  written++;
+  return true;
+}
+
+void Hid_Feedback::clear()
+{
+  memset(pending_length, 0, sizeof(pending_length));
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum FEEDBACK_KIND {
+  FEEDBACK_RUMBLE = 0,
+  FEEDBACK_LED,
+  FEEDBACK_KINDS
+};
+
+#define FEEDBACK_MAX_PAYLOAD 8
+#define FEEDBACK_RUMBLE_SIZE 8 /** the report rumble() builds */
+
+/** Sends one output report, returns false if the peer has no such report */
+typedef bool (*feedback_write_t)(uint8_t kind, const uint8_t *data, size_t length);
+
+// Output channel back to the controller: rumble and LED commands.
+//
+// Each kind has one pending slot, queueing again replaces what has not been
+// sent yet, so bursts of events coalesce into their latest state. pump()
+// writes at most one report per connection interval, so feedback never
+// takes more than one packet of a connection event away from the input
+// notifications. The writer is a plain function, which lets a simulated
+// peripheral stand in for the BLE client.
+//
+// There is no locking: queue(), pump() and clear() belong to the loop()
+// task. Events from other tasks reach it through the BLE event queue.
+//
+// rumble() builds the Xbox style 8 byte force feedback report. The client
+// only exposes a rumble target whose Report Map declares exactly that.
+class Hid_Feedback {
+ public:
+    Hid_Feedback() {
+      write_function = NULL;
+      interval_us = 15000;
+      last_write_us = 0;
+      next_kind = 0;
+      written = 0;
+      coalesced = 0;
+      failed = 0;
+      clear();
+    }
+
+    void set_writer(feedback_write_t f) { write_function = f; }
+    feedback_write_t get_writer() { return write_function; }
+    /** The connection interval, the minimum spacing of two writes */
+    void set_interval_us(uint32_t us) { interval_us = us; }
+
+    bool queue(uint8_t kind, const uint8_t *data, size_t length);
+    /** Rumble both motors, strength 0..100, for duration_ms */
+    bool rumble(uint8_t strength, uint16_t duration_ms);
+    /** Boot keyboard style LED bits: 1 = Num Lock, 2 = Caps Lock, 4 = Scroll Lock */
+    bool leds(uint8_t bits);
+
+    /** Send the next pending report if the interval allows, true if written */
+    bool pump(uint32_t now_us);
+    /** Drop everything pending, e.g. on disconnect */
+    void clear();
+
+    uint32_t get_written() { return written; }
+    uint32_t get_coalesced() { return coalesced; }
+    uint32_t get_failed() { return failed; }
+
+ private:
+    feedback_write_t write_function;
+    uint32_t interval_us;
+    uint32_t last_write_us;
+    uint8_t next_kind;
+    uint8_t pending_length[FEEDBACK_KINDS];
+    uint8_t pending[FEEDBACK_KINDS][FEEDBACK_MAX_PAYLOAD];
+    uint32_t written;
+    uint32_t coalesced;
+    uint32_t failed;
+};
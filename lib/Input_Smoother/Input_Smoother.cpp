@@ -0,0 +1,106 @@
+#include "Input_Smoother.h"
+
+void Input_Smoother::push(uint32_t t_us, int x, int y)
+{
+  if (count == 0)
+  {
+    /** First report: nothing to ramp from, start from rest */
+    t0 = t_us - max_span;
+    x0 = 0;
+    y0 = 0;
+    count = 1;
+  }
+  else
+  {
+    /** Carry on from where the output currently is so a new report never
+     *  makes the setpoint jump back to an older value.
+     */
+    sample(t_us, x0, y0);
+    uint32_t gap = t_us - t1;
+    t0 = t_us - (gap > max_span ? max_span : gap);
+  }
+  t1 = t_us;
+  x1 = x;
+  y1 = y;
+}
+
+void Input_Smoother::sample(uint32_t t_us, int &x, int &y) const
+{
+  if (count == 0)
+  {
+    x = 0;
+    y = 0;
+    return;
+  }
+  uint32_t span = t1 - t0;
+  int32_t dt = (int32_t)(t_us - render_delay - t1);
+  x = render(x0, x1, span, dt);
+  y = render(y0, y1, span, dt);
+}
+
+/** dt is the render time relative to the newest report, negative inside
+ *  the interval [t0, t1], positive when extrapolating.
+ */
+int Input_Smoother::render(int v0, int v1, uint32_t span, int32_t dt) const
+{
+  int32_t step = v1 - v0;
+  if (span == 0 || step == 0)
+    return v1;
+
+  if (dt <= 0)
+  {
+    int32_t into = (int32_t)span + dt;
+    if (into <= 0)
+      return v0;
+    return v0 + step * into / (int32_t)span;
+  }
+
+  /** Only a stick moving away from centre is extrapolated. Gamepads report
+   *  on change, so silence after a step back towards centre, a release above
+   *  all, means the stick has stopped there: hold it instead of driving past
+   *  it or through zero.
+   */
+  if (max_extrapolation == 0 || v1 == 0 || (step > 0) != (v1 > 0))
+    return v1;
+
+  /** The next report is due one interval after the newest, in render time
+   *  that is span - render_delay past it. Predict no further than that. */
+  int32_t h = (int32_t)max_extrapolation;
+  int32_t due = (int32_t)span - (int32_t)render_delay;
+  int32_t horizon = due < h ? due : h;
+  if (horizon <= 0)
+    return v1;
+  int32_t off;
+  if (dt <= horizon)
+  {
+    off = (int32_t)((int64_t)step * dt / (int32_t)span);
+  }
+  else if (dt < horizon + h)
+  {
+    /** Overdue or past the horizon: ease back onto the newest report */
+    off = (int32_t)((int64_t)step * horizon / (int32_t)span);
+    off = off > INPUT_SMOOTHER_MAX_OVERSHOOT ? INPUT_SMOOTHER_MAX_OVERSHOOT : off;
+    off = off < -INPUT_SMOOTHER_MAX_OVERSHOOT ? -INPUT_SMOOTHER_MAX_OVERSHOOT : off;
+    off = off * (horizon + h - dt) / h;
+  }
+  else
+  {
+    return v1;
+  }
+
+  /** Never further than one report step or the overshoot bound, nor past full scale */
+  if (step > 0 && off > step)
+    off = step;
+  if (step < 0 && off < step)
+    off = step;
+  if (off > INPUT_SMOOTHER_MAX_OVERSHOOT)
+    off = INPUT_SMOOTHER_MAX_OVERSHOOT;
+  if (off < -INPUT_SMOOTHER_MAX_OVERSHOOT)
+    off = -INPUT_SMOOTHER_MAX_OVERSHOOT;
+  int v = v1 + off;
+  if (v > INPUT_SMOOTHER_FULL_SCALE)
+    return v1 > INPUT_SMOOTHER_FULL_SCALE ? v1 : INPUT_SMOOTHER_FULL_SCALE;
+  if (v < -INPUT_SMOOTHER_FULL_SCALE)
+    return v1 < -INPUT_SMOOTHER_FULL_SCALE ? v1 : -INPUT_SMOOTHER_FULL_SCALE;
+  return v;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+
+#define INPUT_SMOOTHER_FULL_SCALE 255 /** decode_axis() range, extrapolation stops there */
+#define INPUT_SMOOTHER_MAX_OVERSHOOT 8 /** furthest the output goes past the newest report */
+
+// Turns the bursty stream of decoded stick reports into a smooth setpoint
+// that can be sampled at a fixed control rate, independent of the BLE
+// connection interval.
+//
+// Reports are timestamped on arrival. Sampling at time t renders the input
+// at (t - render_delay): inside the last report interval the value is
+// interpolated, past the newest report it is extrapolated along the last
+// slope, then eased back onto the newest report. Prediction only runs until
+// the next report is due: one that is overdue means the stick stopped. It
+// also stops after max_extrapolation, and it never goes further than
+// INPUT_SMOOTHER_MAX_OVERSHOOT past the newest report or past full scale.
+// Only a stick moving away from centre is extrapolated. A step back
+// towards centre or a release holds the newest value, so stale input never
+// drives past it or reverses the motors.
+class Input_Smoother {
+ public:
+    Input_Smoother(uint32_t render_delay_us = 0,
+                   uint32_t max_extrapolation_us = 20000,
+                   uint32_t max_span_us = 100000) {
+      render_delay = render_delay_us;
+      max_extrapolation = max_extrapolation_us;
+      max_span = max_span_us;
+      reset();
+    }
+
+    void reset() {
+      count = 0;
+      t0 = t1 = 0;
+      x0 = y0 = x1 = y1 = 0;
+    }
+    /** Record a report received at t_us (micros()). */
+    void push(uint32_t t_us, int x, int y);
+    /** Render the smoothed setpoint at t_us. Returns 0, 0 before any report. */
+    void sample(uint32_t t_us, int &x, int &y) const;
+    /** Time since the newest report, 0xFFFFFFFF before any report. */
+    uint32_t age(uint32_t t_us) const {
+      return count ? t_us - t1 : 0xFFFFFFFF;
+    }
+
+    void set_render_delay(uint32_t us) { render_delay = us; }
+    uint32_t get_render_delay() { return render_delay; }
+    void set_max_extrapolation(uint32_t us) { max_extrapolation = us; }
+    uint32_t get_max_extrapolation() { return max_extrapolation; }
+    /** Longest interval interpolated over, a report after a longer pause
+     *  ramps in over this time instead of over the whole pause. */
+    void set_max_span(uint32_t us) { max_span = us; }
+    uint32_t get_max_span() { return max_span; }
+
+ private:
+    int render(int v0, int v1, uint32_t span, int32_t dt) const;
+
+    uint32_t render_delay;
+    uint32_t max_extrapolation;
+    uint32_t max_span;
+    uint8_t count;
+    uint32_t t0, t1;
+    int x0, y0, x1, y1;
+};
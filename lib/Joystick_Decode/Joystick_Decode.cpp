@@ -0,0 +1,145 @@
+#include "Joystick_Decode.h"
+#include <string.h>
+
+bool decode_report(const uint8_t *data, size_t length, joystick_t &report)
+{
+  if (length < sizeof(joystick_t))
+    return false;
+  memcpy(&report, data, sizeof(joystick_t));
+  return true;
+}
+
+/** HID_APP_* bit of a Generic Desktop application usage */
+static uint8_t application_bit(uint32_t usage)
+{
+  switch (usage)
+  {
+  case 0x00010002:
+    return HID_APP_MOUSE;
+  case 0x00010004:
+    return HID_APP_JOYSTICK;
+  case 0x00010005:
+    return HID_APP_GAMEPAD;
+  case 0x00010006:
+    return HID_APP_KEYBOARD;
+  default:
+    return 0;
+  }
+}
+
+/** Steps over one short item at map[i], long items are skipped whole.
+ *  Returns the index of the next item, 0 at the end or when truncated. */
+static size_t next_item(const uint8_t *map, size_t length, size_t i,
+                        uint8_t &tag, uint32_t &data, size_t &size)
+{
+  while (i < length && map[i] == 0xFE) /** long item: size byte, tag byte, data */
+  {
+    if (i + 1 >= length)
+      return 0;
+    i += 3 + map[i + 1];
+  }
+  if (i >= length)
+    return 0;
+  uint8_t prefix = map[i];
+  size = (prefix & 3) == 3 ? 4 : prefix & 3;
+  if (i + 1 + size > length)
+    return 0;
+  data = 0;
+  for (size_t b = 0; b < size; b++)
+    data |= (uint32_t)map[i + 1 + b] << (8 * b);
+  tag = prefix & 0xFC;
+  return i + 1 + size;
+}
+
+uint8_t report_map_applications(const uint8_t *map, size_t length)
+{
+  uint8_t apps = 0;
+  uint32_t page = 0;  /** Usage Page, a global item */
+  uint32_t usage = 0; /** last Usage, page in the high half */
+  int depth = 0;
+  uint8_t tag;
+  uint32_t data;
+  size_t size;
+  for (size_t i = 0; (i = next_item(map, length, i, tag, data, size)) != 0;)
+  {
+    switch (tag)
+    {
+    case 0x04: /** Usage Page */
+      page = data;
+      break;
+    case 0x08: /** Usage, 4 bytes carry their own page */
+      usage = size == 4 ? data : (page << 16) | data;
+      break;
+    case 0xA0: /** Collection */
+      if (depth == 0 && data == 1) /** Application */
+        apps |= application_bit(usage);
+      depth++;
+      usage = 0;
+      break;
+    case 0xC0: /** End Collection */
+      if (depth > 0)
+        depth--;
+      usage = 0;
+      break;
+    case 0x80: /** Input, Output, Feature end the local items */
+    case 0x90:
+    case 0xB0:
+      usage = 0;
+      break;
+    }
+  }
+  return apps;
+}
+
+size_t report_map_output_size(const uint8_t *map, size_t length, uint8_t report_id, bool &pid)
+{
+  uint32_t page = 0;
+  uint32_t id = 0;
+  uint32_t report_size = 0;
+  uint32_t report_count = 0;
+  uint32_t bits = 0;
+  uint8_t tag;
+  uint32_t data;
+  size_t size;
+  pid = false;
+  for (size_t i = 0; (i = next_item(map, length, i, tag, data, size)) != 0;)
+  {
+    switch (tag)
+    {
+    case 0x04: /** Usage Page */
+      page = data;
+      break;
+    case 0x74: /** Report Size, bits per field */
+      report_size = data;
+      break;
+    case 0x84: /** Report ID */
+      id = data;
+      break;
+    case 0x94: /** Report Count */
+      report_count = data;
+      break;
+    case 0x90: /** Output */
+      if (id != report_id)
+        break;
+      bits += report_size * report_count;
+      if (page == 0x0F) /** Physical Interface Device */
+        pid = true;
+      break;
+    }
+  }
+  return (bits + 7) / 8;
+}
+
+void Button_Edges::dispatch(uint16_t buttons, button_edge_callback_t const functions[16])
+{
+  uint16_t changed = update(buttons);
+  for (size_t i = 0; changed; i++)
+  {
+    if ((changed & 1) && functions[i])
+    {
+      (*functions[i])(buttons & 1);
+    }
+    changed >>= 1;
+    buttons >>= 1;
+  }
+}
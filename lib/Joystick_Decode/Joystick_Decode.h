@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Decoding of the gamepad reports, kept free of Arduino and NimBLE so the
+// same code runs in the firmware and in the native benchmark.
+
+// Joystick HID report format of the "Fortune Key/Game" BLE joystick
+typedef struct __attribute__((__packed__))
+{
+  uint8_t x;
+  uint8_t y;
+  uint8_t z;
+  uint8_t rz;
+  uint8_t brake;
+  uint8_t accel;
+  uint8_t hat;
+  uint16_t buttons;
+} joystick_t;
+
+/** Map a raw 0..255 axis, 128 centred, to -255..255. Up/left is positive. */
+static inline int decode_axis(uint8_t raw)
+{
+  if (raw == 128)
+    return 0;
+  return ((128 - (int)raw) << 1) - 1;
+}
+
+/** Copy a raw notification into report, false if it is too short */
+bool decode_report(const uint8_t *data, size_t length, joystick_t &report);
+
+// Top level application collections of a HID Report Map, Generic Desktop page
+#define HID_APP_MOUSE 0x01
+#define HID_APP_JOYSTICK 0x02
+#define HID_APP_GAMEPAD 0x04
+#define HID_APP_KEYBOARD 0x08
+
+/** HID_APP_* bits for the applications a Report Map declares, 0 if none */
+uint8_t report_map_applications(const uint8_t *map, size_t length);
+/** Bytes of output report report_id in a Report Map, 0 if it declares none.
+ *  pid: some of its fields are on the Physical Interface Device (force
+ *  feedback) page. */
+size_t report_map_output_size(const uint8_t *map, size_t length, uint8_t report_id, bool &pid);
+
+typedef void (*button_edge_callback_t)(bool);
+
+// Turns button bitmaps into press/release edges.
+class Button_Edges {
+ public:
+    Button_Edges() { last_buttons = 0; }
+
+    void reset() { last_buttons = 0; }
+    /** Returns the bits that changed since the previous call */
+    uint16_t update(uint16_t buttons) {
+      uint16_t changed = last_buttons ^ buttons;
+      last_buttons = buttons;
+      return changed;
+    }
+    /** Calls functions[i](pressed) for every button i that changed */
+    void dispatch(uint16_t buttons, button_edge_callback_t const functions[16]);
+
+ private:
+    uint16_t last_buttons;
+};
@@ -0,0 +1,161 @@
+#include "Link_Monitor.h"
+
+static const char *EVENT_NAMES[] = {"connect", "disconnect", "profile", "phy", "stats"};
+static const uint8_t WINDOW_SAMPLES = 4; /** RSSI samples per stats window */
+static const uint32_t MIN_WINDOW_NOTIFIES = 10;
+
+void Link_Monitor::reset_link(uint16_t itvl)
+{
+  connected = itvl != 0;
+  profile = LINK_NORMAL;
+  requested_phy = 0;
+  phy = 1;
+  refused_phys = 0;
+  conn_itvl = itvl;
+  have_rssi = false;
+  rssi_avg = 0;
+  samples = 0;
+  profile_ms = 0;
+  last_notify_us = 0;
+  last_moving = false;
+  notifies = 0;
+  missed = 0;
+  max_gap_us = 0;
+}
+
+void Link_Monitor::on_connect(uint16_t itvl)
+{
+  reset_link(itvl);
+  profile_ms = millis();
+  record(LINK_EV_CONNECT, itvl);
+}
+
+void Link_Monitor::on_disconnect(int reason)
+{
+  record(LINK_EV_DISCONNECT, reason);
+  reset_link(0);
+}
+
+void Link_Monitor::on_notify(uint32_t t_us, bool moving)
+{
+  if (last_notify_us && conn_itvl && moving && last_moving)
+  {
+    uint32_t gap = t_us - last_notify_us;
+    uint32_t itvl_us = conn_itvl * 1250UL;
+    if (gap < IDLE_GAP_EVENTS * itvl_us)
+    {
+      uint32_t events = (gap + itvl_us / 2) / itvl_us;
+      if (events > 1)
+        missed += events - 1;
+      max_gap_us = gap > max_gap_us ? gap : max_gap_us;
+    }
+  }
+  last_notify_us = t_us;
+  last_moving = moving;
+  notifies++;
+}
+
+void Link_Monitor::on_phy_update(uint8_t tx_phy, uint8_t rx_phy)
+{
+  phy = tx_phy;
+  /** The controller settles on what both sides support */
+  if (requested_phy && !(requested_phy & phy_to_mask(tx_phy)))
+  {
+    refused_phys |= requested_phy;
+  }
+  requested_phy = 0;
+  record(LINK_EV_PHY, (tx_phy << 8) | rx_phy);
+}
+
+bool Link_Monitor::on_rssi(int rssi, uint32_t now_ms)
+{
+  if (!connected)
+    return false;
+  rssi_avg = have_rssi ? rssi_avg + ((rssi << 4) - rssi_avg) / 4 : rssi << 4;
+  have_rssi = true;
+  int avg = get_rssi();
+
+  uint32_t n = notifies;
+  uint32_t miss_pct = n >= MIN_WINDOW_NOTIFIES ? missed * 100 / (n + missed) : 0;
+
+  LINK_PROFILE target = profile;
+  if (avg < far_rssi || miss_pct > 20)
+    target = LINK_FAR;
+  else if (avg > near_rssi && miss_pct < 2)
+    target = LINK_NEAR;
+  else if (profile == LINK_FAR && avg > far_rssi + HYSTERESIS_DB && miss_pct < 10)
+    target = LINK_NORMAL;
+  else if (profile == LINK_NEAR && (avg < near_rssi - HYSTERESIS_DB || miss_pct > 5))
+    target = LINK_NORMAL;
+
+  if (++samples >= WINDOW_SAMPLES)
+  {
+    record(LINK_EV_STATS, (int16_t)n);
+    samples = 0;
+    notifies = 0;
+    missed = 0;
+    max_gap_us = 0;
+  }
+
+  if (target == profile || now_ms - profile_ms < MIN_DWELL_MS)
+    return false;
+  profile = target;
+  profile_ms = now_ms;
+  record(LINK_EV_PROFILE, target);
+  return true;
+}
+
+link_params_t Link_Monitor::get_params(LINK_PROFILE p, const link_params_t &normal)
+{
+  link_params_t params = normal;
+  switch (p)
+  {
+  case LINK_NEAR:
+    /** 7.5ms interval, 300ms timeout: fast reports, fast failsafe */
+    params = {LINK_PHY_2M_MASK, 0, 6, 0, 30};
+    break;
+  case LINK_FAR:
+    /** 30ms interval, the coded PHY rides out fades. The 600ms timeout
+     *  stays the failsafe: a longer one keeps the robot driving blind. */
+    params = {LINK_PHY_CODED_MASK, LINK_PHY_CODED_S8, 24, 0, 60};
+    break;
+  default:
+    break;
+  }
+  if (!phy_supported(params.phy_mask))
+  {
+    params.phy_mask = LINK_PHY_1M_MASK;
+    params.phy_options = 0;
+  }
+  return params;
+}
+
+void Link_Monitor::record(uint8_t event, int16_t value)
+{
+  link_record_t r;
+  r.ms = millis();
+  r.event = event;
+  r.profile = profile;
+  r.phy = phy;
+  r.rssi = have_rssi ? get_rssi() : 0;
+  r.value = value;
+  r.missed = missed > 0xFFFF ? 0xFFFF : missed;
+  r.max_gap_ms = max_gap_us / 1000;
+  ring[ring_head] = r;
+  ring_head = (ring_head + 1) % RING_SIZE;
+  if (ring_count < RING_SIZE)
+    ring_count++;
+}
+
+void Link_Monitor::print_records(Print &out)
+{
+  out.printf("link profile=%d phy=%d rssi=%d itvl=%u\n",
+             profile, phy, get_rssi(), conn_itvl);
+  for (size_t i = 0; i < get_record_count(); i++)
+  {
+    const link_record_t &r = get_record(i);
+    out.printf("%lu %s profile=%d phy=%d rssi=%d value=%d missed=%u max_gap_ms=%u\n",
+               (unsigned long)r.ms, EVENT_NAMES[r.event], r.profile, r.phy,
+               r.rssi, r.value, r.missed, r.max_gap_ms);
+  }
+}
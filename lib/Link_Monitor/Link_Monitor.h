@@ -0,0 +1,136 @@
+#pragma once
+
+#include <Arduino.h>
+
+// PHY masks and coded PHY option, same values as the NimBLE BLE_GAP_LE_PHY_*
+#define LINK_PHY_1M_MASK 0x01
+#define LINK_PHY_2M_MASK 0x02
+#define LINK_PHY_CODED_MASK 0x04
+#define LINK_PHY_CODED_S8 2
+
+enum LINK_PROFILE {
+  LINK_NORMAL = 0, /** 1M PHY, connection parameters from the config */
+  LINK_NEAR,       /** 2M PHY, short interval and timeout for low latency */
+  LINK_FAR         /** Coded PHY S8, 30ms interval: resends a lost packet sooner than the 150ms default */
+};
+
+enum LINK_EVENT {
+  LINK_EV_CONNECT = 0,
+  LINK_EV_DISCONNECT,
+  LINK_EV_PROFILE,
+  LINK_EV_PHY,
+  LINK_EV_STATS
+};
+
+// What the client should request for a profile
+struct link_params_t
+{
+  uint8_t phy_mask;
+  uint16_t phy_options;
+  uint16_t itvl;    /** 1.25ms units */
+  uint16_t latency;
+  uint16_t tmo;     /** 10ms units */
+};
+
+// One post-mortem record
+struct link_record_t
+{
+  uint32_t ms;
+  uint8_t event;    /** LINK_EVENT */
+  uint8_t profile;  /** LINK_PROFILE at the time */
+  uint8_t phy;      /** 1 = 1M, 2 = 2M, 3 = Coded */
+  int8_t rssi;      /** smoothed dBm */
+  int16_t value;    /** disconnect reason, new profile... */
+  uint16_t missed;  /** estimated missed connection events since the last record */
+  uint16_t max_gap_ms;
+};
+
+// Tracks link quality of the HID connection and picks a PHY and connection
+// parameter profile for it.
+//
+// Gamepads only notify while the input changes, so a quiet interval is
+// just as likely a stick held still as a lost packet. A gap is counted as
+// missed connection events only when the stick was moving on both sides of
+// it, and only when it is shorter than IDLE_GAP_EVENTS intervals.
+//
+// Not thread safe, everything is called from loop(): RSSI samples, link
+// events and on_notify() with the arrival time the BLE task stamped on the
+// queued report.
+class Link_Monitor {
+ public:
+    Link_Monitor() {
+      near_rssi = -60;
+      far_rssi = -85;
+      ring_head = 0;
+      ring_count = 0;
+      reset_link(0);
+    }
+
+    void on_connect(uint16_t itvl);
+    void on_disconnect(int reason);
+    /** Called for every input report, moving: the stick changed since the last one */
+    void on_notify(uint32_t t_us, bool moving);
+    /** Remember the PHY asked for, to spot a peer that does not support it */
+    void on_phy_requested(uint8_t phy_mask) { requested_phy = phy_mask; }
+    void on_phy_update(uint8_t tx_phy, uint8_t rx_phy);
+    /** Feed a fresh RSSI sample, returns true when the profile changed */
+    bool on_rssi(int rssi, uint32_t now_ms);
+    /** Note the interval and timeout actually in use */
+    void on_params(uint16_t itvl) { conn_itvl = itvl; }
+
+    LINK_PROFILE get_profile() { return profile; }
+    /** Parameters for a profile, normal is the configured post-connect set */
+    link_params_t get_params(LINK_PROFILE p, const link_params_t &normal);
+    /** The peer refused this PHY once, do not ask again on this connection */
+    bool phy_supported(uint8_t phy_mask) { return !(refused_phys & phy_mask); }
+    int get_rssi() { return rssi_avg >> 4; }
+    uint8_t get_phy() { return phy; }
+    /** Connection interval in 1.25ms units, 0 when not connected */
+    uint16_t get_itvl() { return conn_itvl; }
+    /** PHY value (1 = 1M, 2 = 2M, 3 = Coded) to its LINK_PHY_*_MASK */
+    static uint8_t phy_to_mask(uint8_t phy) {
+      return phy == 2 ? LINK_PHY_2M_MASK : phy == 3 ? LINK_PHY_CODED_MASK : LINK_PHY_1M_MASK;
+    }
+
+    void set_thresholds(int near_dbm, int far_dbm) {
+      near_rssi = near_dbm;
+      far_rssi = far_dbm;
+    }
+
+    /** Oldest first, index < get_record_count() */
+    size_t get_record_count() { return ring_count; }
+    const link_record_t &get_record(size_t index) {
+      return ring[(ring_head + RING_SIZE - ring_count + index) % RING_SIZE];
+    }
+    void print_records(Print &out);
+
+ private:
+    static const size_t RING_SIZE = 32;
+    static const uint16_t IDLE_GAP_EVENTS = 8;
+    static const uint32_t MIN_DWELL_MS = 3000;
+    static const int HYSTERESIS_DB = 5;
+
+    void reset_link(uint16_t itvl);
+    void record(uint8_t event, int16_t value);
+
+    int near_rssi;
+    int far_rssi;
+    bool connected;
+    LINK_PROFILE profile;
+    uint8_t requested_phy;
+    uint8_t phy;
+    uint8_t refused_phys;
+    uint16_t conn_itvl;
+    int32_t rssi_avg;        /** dBm * 16 */
+    bool have_rssi;
+    uint8_t samples;
+    uint32_t profile_ms;
+    uint32_t last_notify_us;
+    bool last_moving;
+    uint32_t notifies;
+    uint32_t missed;
+    uint32_t max_gap_us;
+    link_record_t ring[RING_SIZE];
+    size_t ring_head;
+    size_t ring_count;
+};
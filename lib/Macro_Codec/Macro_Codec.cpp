@@ -0,0 +1,162 @@
+#include "Macro_Codec.h"
+
+size_t put_varint(uint8_t *out, uint32_t v)
+{
+  size_t n = 0;
+  while (v >= 0x80)
+  {
+    out[n++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  out[n++] = (uint8_t)v;
+  return n;
+}
+
+size_t get_varint(const uint8_t *in, size_t available, uint32_t &v)
+{
+  v = 0;
+  for (size_t n = 0; n < available && n < 5; n++)
+  {
+    v |= (uint32_t)(in[n] & 0x7F) << (7 * n);
+    if (!(in[n] & 0x80))
+      return n + 1;
+  }
+  return 0;
+}
+
+size_t macro_put_frame(uint8_t *out, const macro_frame_t &frame)
+{
+  size_t n = put_varint(out, (frame.dt_us << 2) | (frame.axes & (MACRO_AXIS_X | MACRO_AXIS_Y)));
+  if (frame.axes & MACRO_AXIS_X)
+    n += put_varint(out + n, zigzag(frame.dx));
+  if (frame.axes & MACRO_AXIS_Y)
+    n += put_varint(out + n, zigzag(frame.dy));
+  return n;
+}
+
+size_t macro_get_frame(const uint8_t *in, size_t available, macro_frame_t &frame)
+{
+  uint32_t head, v;
+  size_t n = get_varint(in, available, head);
+  if (n == 0)
+    return 0;
+  frame.dt_us = head >> 2;
+  frame.axes = head & (MACRO_AXIS_X | MACRO_AXIS_Y);
+  frame.dx = 0;
+  frame.dy = 0;
+  if (frame.axes & MACRO_AXIS_X)
+  {
+    size_t m = get_varint(in + n, available - n, v);
+    if (m == 0)
+      return 0;
+    frame.dx = unzigzag(v);
+    n += m;
+  }
+  if (frame.axes & MACRO_AXIS_Y)
+  {
+    size_t m = get_varint(in + n, available - n, v);
+    if (m == 0)
+      return 0;
+    frame.dy = unzigzag(v);
+    n += m;
+  }
+  return n;
+}
+
+void Macro_Recorder::start(uint32_t t_us)
+{
+  length = 0;
+  frames = 0;
+  duration_us = 0;
+  full = false;
+  last_t_us = t_us;
+  last_x = 0;
+  last_y = 0;
+  recording = true;
+}
+
+/** reserve: bytes to keep free after this frame */
+bool Macro_Recorder::append(uint32_t t_us, int x, int y, size_t reserve)
+{
+  if (length + MACRO_MAX_FRAME_SIZE + reserve > size)
+    return false;
+  int32_t dt_us = (int32_t)(t_us - last_t_us);
+  macro_frame_t frame;
+  frame.dt_us = dt_us < 0 ? 0 : (uint32_t)dt_us;
+  if (frame.dt_us > MACRO_MAX_DT_US)
+    frame.dt_us = MACRO_MAX_DT_US;
+  frame.axes = (x != last_x ? MACRO_AXIS_X : 0) | (y != last_y ? MACRO_AXIS_Y : 0);
+  frame.dx = x - last_x;
+  frame.dy = y - last_y;
+  length += macro_put_frame(buffer + length, frame);
+  if (dt_us > 0)
+    last_t_us = t_us;
+  last_x = x;
+  last_y = y;
+  frames++;
+  duration_us += frame.dt_us;
+  return true;
+}
+
+bool Macro_Recorder::record(uint32_t t_us, int x, int y)
+{
+  if (!recording || (x == last_x && y == last_y))
+    return true;
+  /** Room for the closing frame is always kept */
+  if (append(t_us, x, y, MACRO_MAX_FRAME_SIZE))
+    return true;
+  stop(t_us);
+  full = true;
+  return false;
+}
+
+void Macro_Recorder::stop(uint32_t t_us)
+{
+  full = false;
+  if (!recording)
+    return;
+  /** Closing frame without changes: hold the last setpoint until now */
+  append(t_us, last_x, last_y, 0);
+  recording = false;
+}
+
+bool Macro_Recorder::restore(size_t length)
+{
+  recording = false;
+  full = false;
+  this->length = length > size ? 0 : length;
+  frames = 0;
+  duration_us = 0;
+  /** Walk the take once to restore the frame count and duration */
+  size_t pos = 0;
+  while (pos < this->length)
+  {
+    macro_frame_t frame;
+    size_t n = macro_get_frame(buffer + pos, this->length - pos, frame);
+    if (n == 0)
+      break;
+    pos += n;
+    frames++;
+    duration_us += frame.dt_us;
+  }
+  return frames != 0;
+}
+
+bool Macro_Reader::next(uint32_t &at_us, int &x, int &y, bool &changed)
+{
+  if (!buffer)
+    return false;
+  macro_frame_t frame;
+  size_t n = macro_get_frame(buffer + pos, length - pos, frame);
+  if (n == 0)
+    return false;
+  pos += n;
+  this->at_us += frame.dt_us;
+  this->x += frame.dx;
+  this->y += frame.dy;
+  at_us = this->at_us;
+  x = this->x;
+  y = this->y;
+  changed = frame.axes != 0;
+  return true;
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Frame encoding, recording and read back of the Drive_Macro takes, kept
+// free of Arduino so the recorder can be tested on the host.
+//
+// A frame is a varint of (time since the previous frame in us << 2 | changed
+// axes), followed by a zigzag varint delta for each axis that changed.
+
+#define MACRO_AXIS_X 0x01
+#define MACRO_AXIS_Y 0x02
+#define MACRO_MAX_FRAME_SIZE (5 + 2 + 2) /** varint32 + two zigzag axis deltas */
+#define MACRO_MAX_DT_US ((1UL << 30) - 1)
+
+typedef struct
+{
+  uint32_t dt_us; /** since the previous frame, at most MACRO_MAX_DT_US */
+  uint8_t axes;   /** MACRO_AXIS_* that changed */
+  int32_t dx;     /** only meaningful for the axes that changed */
+  int32_t dy;
+} macro_frame_t;
+
+static inline uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+/** Returns the bytes written, at most 5 */
+size_t put_varint(uint8_t *out, uint32_t v);
+/** Returns the bytes read, 0 if truncated */
+size_t get_varint(const uint8_t *in, size_t available, uint32_t &v);
+
+/** out needs MACRO_MAX_FRAME_SIZE bytes, returns the bytes written */
+size_t macro_put_frame(uint8_t *out, const macro_frame_t &frame);
+/** Returns the bytes read, 0 if the frame is truncated */
+size_t macro_get_frame(const uint8_t *in, size_t available, macro_frame_t &frame);
+
+// Records setpoint changes into a caller owned buffer. Room for the closing
+// frame is always kept, so when the buffer fills the take is closed at that
+// point and the recorder goes full until stop() acknowledges it.
+//
+// Times are the input's own stamps. One older than the previous frame, e.g.
+// a report that arrived before start() was called, counts as no time.
+class Macro_Recorder {
+ public:
+    Macro_Recorder(uint8_t *buffer, size_t size) {
+      this->buffer = buffer;
+      this->size = size;
+      length = 0;
+      frames = 0;
+      duration_us = 0;
+      recording = false;
+      full = false;
+      last_t_us = 0;
+      last_x = last_y = 0;
+    }
+
+    void start(uint32_t t_us);
+    /** Append a frame. false once, when the buffer filled and closed the take. */
+    bool record(uint32_t t_us, int x, int y);
+    /** Ends the take, the last setpoint is held until t_us on playback.
+     *  After the buffer filled it only clears the full state. */
+    void stop(uint32_t t_us);
+    /** Adopt a take already in the buffer, false if it holds no frame */
+    bool restore(size_t length);
+
+    bool is_recording() { return recording; }
+    bool is_full() { return full; }
+    size_t get_length() { return length; }
+    uint16_t get_frames() { return frames; }
+    uint32_t get_duration_us() { return duration_us; }
+
+ private:
+    bool append(uint32_t t_us, int x, int y, size_t reserve);
+
+    uint8_t *buffer;
+    size_t size;
+    size_t length;
+    uint16_t frames;
+    uint32_t duration_us;
+    bool recording;
+    bool full;
+    uint32_t last_t_us;
+    int last_x, last_y;
+};
+
+// Walks a take frame by frame. Times are offsets from the start of the take,
+// so a player that schedules against them does not accumulate latency.
+class Macro_Reader {
+ public:
+    Macro_Reader() { reset(nullptr, 0); }
+
+    void reset(const uint8_t *buffer, size_t length) {
+      this->buffer = buffer;
+      this->length = length;
+      pos = 0;
+      at_us = 0;
+      x = y = 0;
+    }
+    /** Next frame, false at the end. changed: the setpoint moved with it. */
+    bool next(uint32_t &at_us, int &x, int &y, bool &changed);
+
+ private:
+    const uint8_t *buffer;
+    size_t length;
+    size_t pos;
+    uint32_t at_us;
+    int x, y;
+};
@@ -0,0 +1,283 @@
+#include "Pipeline_Bench.h"
+#include <Joystick_Decode.h>
+#include <Drive_Mixer.h>
+#include <Input_Smoother.h>
+#include <Gesture_Engine.h>
+#include <Drive_Gestures.h>
+#include <stdio.h>
+#include <string.h>
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+static const char UNIT[] = "cycles";
+static inline uint32_t bench_ticks() { return ESP.getCycleCount(); }
+static inline uint32_t ticks_per_second() { return getCpuFrequencyMhz() * 1000000UL; }
+#else
+#include <chrono>
+static const char UNIT[] = "ns";
+static inline uint32_t bench_ticks()
+{
+  return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+static inline uint32_t ticks_per_second() { return 1000000000UL; }
+#endif
+
+static const size_t REPORT_COUNT = 64;
+static uint8_t reports[REPORT_COUNT][sizeof(joystick_t)];
+static volatile int sink;
+
+struct bench_stats_t
+{
+  uint32_t min;
+  uint32_t max;
+  uint64_t total;
+  uint32_t count;
+};
+
+static void stats_reset(bench_stats_t &s)
+{
+  s.min = UINT32_MAX;
+  s.max = 0;
+  s.total = 0;
+  s.count = 0;
+}
+
+static void stats_add(bench_stats_t &s, uint32_t v)
+{
+  s.min = v < s.min ? v : s.min;
+  s.max = v > s.max ? v : s.max;
+  s.total += v;
+  s.count++;
+}
+
+/** Deterministic stick sweeps and button presses, same on every run */
+static void make_reports()
+{
+  uint32_t lcg = 12345;
+  for (size_t i = 0; i < REPORT_COUNT; i++)
+  {
+    lcg = lcg * 1664525UL + 1013904223UL;
+    joystick_t r;
+    memset(&r, 128, sizeof(r));
+    r.x = (uint8_t)(i * 4);
+    r.y = (uint8_t)(255 - i * 4);
+    /** The gesture button byte: start, the chord buttons and the relay select bits */
+    r.accel = (lcg >> 24) & 0x3F;
+    r.buttons = (uint16_t)(lcg >> 8);
+    memcpy(reports[i], &r, sizeof(r));
+  }
+}
+
+static void stub_pwm(int left, int right)
+{
+  sink = left ^ right;
+}
+
+static void button_cb(bool pressed)
+{
+  sink += pressed;
+}
+
+static void gesture_cb(uint8_t action, uint8_t arg)
+{
+  sink += action + arg;
+}
+
+/** The rules main.cpp loads on a relay sender, the longest table */
+static void load_gestures(Gesture_Engine &gestures)
+{
+  gestures.set_action_callback(gesture_cb);
+  load_drive_gestures(gestures, true);
+}
+
+/** Stats are kept in hundredths, printed with two decimals */
+static void print_stats(bench_print_t print, const char *name,
+                        const bench_config_t &config, const bench_stats_t &s)
+{
+  char line[200];
+  unsigned long avg = s.count ? (unsigned long)(s.total / s.count) : 0;
+  snprintf(line, sizeof(line),
+           "{\"bench\":\"%s\",\"unit\":\"%s\",\"rounds\":%u,\"n\":%u,"
+           "\"min\":%lu.%02lu,\"avg\":%lu.%02lu,\"max\":%lu.%02lu}",
+           name, UNIT, (unsigned)config.rounds, (unsigned)config.n,
+           (unsigned long)s.min / 100, (unsigned long)s.min % 100,
+           avg / 100, avg % 100,
+           (unsigned long)s.max / 100, (unsigned long)s.max % 100);
+  print(line);
+}
+
+/** Times config.n calls of op per round, keeps per-operation figures */
+template <typename Op>
+static bench_micro_t bench(const char *name, const bench_config_t &config,
+                           bench_print_t print, Op op)
+{
+  bench_stats_t s;
+  stats_reset(s);
+  uint32_t base = bench_ticks();
+  base = bench_ticks() - base; /** cost of reading the counter */
+  for (uint16_t r = 0; r < config.rounds; r++)
+  {
+    uint32_t start = bench_ticks();
+    for (uint16_t i = 0; i < config.n; i++)
+    {
+      op(i);
+    }
+    uint32_t elapsed = bench_ticks() - start;
+    elapsed = elapsed > base ? elapsed - base : 0;
+    stats_add(s, (uint32_t)((uint64_t)elapsed * 100 / config.n));
+  }
+  print_stats(print, name, config, s);
+  bench_micro_t result = {s.min, s.count ? (uint32_t)(s.total / s.count) : 0, s.max};
+  return result;
+}
+
+// What one report costs in main.cpp: decode, gestures, button edges and
+// the smoother push, and what each control tick costs: sample, mix, PWM.
+struct bench_pipeline_state_t
+{
+  Button_Edges edges;
+  button_edge_callback_t functions[16];
+  Gesture_Engine gestures;
+  Input_Smoother smoother;
+  bench_pwm_write_t pwm;
+};
+
+static void report_step(bench_pipeline_state_t &p, const uint8_t *raw, uint32_t t_us)
+{
+  joystick_t report;
+  decode_report(raw, sizeof(joystick_t), report);
+  int y = decode_axis(raw[0]);
+  int x = decode_axis(raw[1]);
+  p.gestures.update(t_us / 1000, report.accel, x, y);
+  p.edges.dispatch(report.buttons, p.functions);
+  p.smoother.push(t_us, x, y);
+}
+
+static void control_step(bench_pipeline_state_t &p, uint32_t t_us)
+{
+  int x, y, left, right;
+  p.smoother.sample(t_us, x, y);
+  mix_drive(x, y, left, right);
+  p.pwm(left, right);
+}
+
+/** Feeds reports paced at rate_hz, runs the control ticks due in between
+ *  and checks each slot fits in its period. Input time is synthetic so the
+ *  smoother sees exact report and tick spacing.
+ */
+static bench_pipeline_t bench_rate(uint32_t rate_hz, const bench_config_t &config,
+                                   bench_print_t print, bench_pipeline_state_t &p)
+{
+  uint32_t period = ticks_per_second() / rate_hz;
+  uint32_t report_us = 1000000UL / rate_hz;
+  uint32_t control_us = 1000000UL / BENCH_CONTROL_HZ;
+  uint32_t t_us = 0;
+  uint32_t next_control_us = 0;
+  bench_stats_t s;
+  stats_reset(s);
+  uint32_t missed = 0;
+  p.smoother.reset();
+  p.gestures.reset();
+  uint32_t next = bench_ticks();
+  for (uint16_t i = 0; i < config.pipeline_n; i++)
+  {
+    /** Wait for the next report slot */
+    while ((int32_t)(bench_ticks() - next) < 0)
+    {
+    }
+    uint32_t t = bench_ticks();
+    report_step(p, reports[i % REPORT_COUNT], t_us);
+    t_us += report_us;
+    for (; (int32_t)(next_control_us - t_us) < 0; next_control_us += control_us)
+    {
+      control_step(p, next_control_us);
+    }
+    uint32_t elapsed = bench_ticks() - t;
+    stats_add(s, elapsed);
+    if (elapsed > period)
+      missed++;
+    next += period;
+  }
+
+  bench_pipeline_t result;
+  result.rate_hz = rate_hz;
+  result.avg = s.count ? (uint32_t)(s.total / s.count) : 0;
+  result.max = s.max;
+  result.budget = period;
+  result.load_x100 = (uint32_t)((uint64_t)result.avg * 10000 / period);
+  result.missed = missed;
+
+  char line[200];
+  snprintf(line, sizeof(line),
+           "{\"bench\":\"pipeline\",\"unit\":\"%s\",\"rate_hz\":%lu,\"n\":%u,"
+           "\"avg\":%lu,\"max\":%lu,\"budget\":%lu,\"load_pct\":%lu.%02lu,\"missed\":%lu}",
+           UNIT, (unsigned long)rate_hz, (unsigned)config.pipeline_n,
+           (unsigned long)result.avg, (unsigned long)result.max, (unsigned long)period,
+           (unsigned long)(result.load_x100 / 100), (unsigned long)(result.load_x100 % 100),
+           (unsigned long)missed);
+  print(line);
+  return result;
+}
+
+void run_pipeline_bench(const bench_config_t &config, bench_print_t print,
+                        bench_results_t *results)
+{
+  static const uint32_t RATES_HZ[BENCH_RATES] = {125, 250, 500, 1000};
+  static bench_pipeline_state_t p;
+  bench_results_t r;
+  p.pwm = config.pwm ? config.pwm : stub_pwm;
+  for (size_t i = 0; i < 16; i++)
+  {
+    p.functions[i] = i % 2 ? NULL : button_cb;
+  }
+  p.gestures.clear();
+  load_gestures(p.gestures);
+  p.smoother.set_render_delay(15000);
+
+  make_reports();
+
+  r.decode_report = bench("decode_report", config, print, [](uint16_t i) {
+    joystick_t report;
+    decode_report(reports[i % REPORT_COUNT], sizeof(joystick_t), report);
+    sink = report.x;
+  });
+  r.decode_axis = bench("decode_axis", config, print, [](uint16_t i) {
+    const uint8_t *raw = reports[i % REPORT_COUNT];
+    sink = decode_axis(raw[0]) + decode_axis(raw[1]);
+  });
+  r.gestures = bench("gestures", config, print, [&](uint16_t i) {
+    const uint8_t *raw = reports[i % REPORT_COUNT];
+    const joystick_t *report = (const joystick_t *)raw;
+    p.gestures.update(i * 8, report->accel, decode_axis(raw[1]), decode_axis(raw[0]));
+  });
+  r.button_edges = bench("button_edges", config, print, [&](uint16_t i) {
+    const joystick_t *report = (const joystick_t *)reports[i % REPORT_COUNT];
+    p.edges.dispatch(report->buttons, p.functions);
+  });
+  r.smoother = bench("smoother", config, print, [&](uint16_t i) {
+    const uint8_t *raw = reports[i % REPORT_COUNT];
+    int x, y;
+    p.smoother.push(i * 7500UL, decode_axis(raw[1]), decode_axis(raw[0]));
+    p.smoother.sample(i * 7500UL + 2000, x, y);
+    sink = x + y;
+  });
+  r.mix = bench("mix", config, print, [](uint16_t i) {
+    int left, right;
+    mix_drive((int)(i & 511) - 255, 255 - (int)(i & 511), left, right);
+    sink = left + right;
+  });
+  r.pwm_write = bench("pwm_write", config, print, [&](uint16_t i) {
+    p.pwm((int)(i & 511) - 255, 255 - (int)(i & 511));
+  });
+  p.pwm(0, 0);
+
+  for (size_t i = 0; i < BENCH_RATES; i++)
+  {
+    r.pipeline[i] = bench_rate(RATES_HZ[i], config, print, p);
+  }
+  p.pwm(0, 0);
+  if (results)
+    *results = r;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdint.h>
+
+// Micro benchmarks for the report hot path: decode, gestures, button edges,
+// the input smoother, the mixer and the PWM write, plus the whole pipeline
+// paced at synthetic report rates with the 500 Hz control tick in between.
+//
+// Every result is printed as one JSON object per line, e.g.
+//   {"bench":"mix","unit":"cycles","rounds":16,"n":1000,"min":21.40,"avg":22.05,"max":30.12}
+//   {"bench":"pipeline","unit":"cycles","rate_hz":1000,"n":500,"avg":412,
+//    "max":2210,"budget":160000,"load_pct":0.25,"missed":0}
+// Micro benchmark min/avg/max are per operation over the rounds. Pipeline
+// figures are per report slot: the report itself and the control ticks due
+// before the next one. Budget is one report period and missed counts slots
+// that did not fit in it. On target the unit is CPU cycles, natively it is
+// nanoseconds. The same figures are returned in bench_results_t so a test
+// can hold them against thresholds.
+
+#define BENCH_RATES 4 /** 125, 250, 500 and 1000 Hz */
+#define BENCH_CONTROL_HZ 500
+
+typedef void (*bench_print_t)(const char *line);
+typedef void (*bench_pwm_write_t)(int left, int right);
+
+struct bench_config_t
+{
+  uint16_t rounds;         /** repetitions of each micro benchmark */
+  uint16_t n;              /** operations timed together per round */
+  uint16_t pipeline_n;     /** reports fed per pipeline rate */
+  bench_pwm_write_t pwm;   /** the real motor write, NULL for a stub */
+};
+
+/** Per operation, in hundredths of a unit */
+struct bench_micro_t
+{
+  uint32_t min;
+  uint32_t avg;
+  uint32_t max;
+};
+
+struct bench_pipeline_t
+{
+  uint32_t rate_hz;
+  uint32_t avg;       /** per report slot */
+  uint32_t max;
+  uint32_t budget;    /** one report period */
+  uint32_t load_x100; /** avg / budget in hundredths of a percent */
+  uint32_t missed;
+};
+
+struct bench_results_t
+{
+  bench_micro_t decode_report;
+  bench_micro_t decode_axis;
+  bench_micro_t gestures;
+  bench_micro_t button_edges;
+  bench_micro_t smoother;  /** one push and one sample */
+  bench_micro_t mix;
+  bench_micro_t pwm_write;
+  bench_pipeline_t pipeline[BENCH_RATES];
+};
+
+/** Run every benchmark, print the results through print and, when given, store them */
+void run_pipeline_bench(const bench_config_t &config, bench_print_t print,
+                        bench_results_t *results = nullptr);
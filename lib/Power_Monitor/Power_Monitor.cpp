@@ -0,0 +1,128 @@
+#include "Power_Monitor.h"
+
+static const uint8_t CH_BATTERY = 0;
+static const uint8_t CH_SENSE_A = 1;
+static const uint8_t CH_SENSE_B = 2;
+
+static void powerTimerCB(void *arg)
+{
+  ((Power_Monitor *)arg)->on_timer();
+}
+
+void Power_Monitor::reset_readings()
+{
+  for (size_t i = 0; i < 3; i++)
+  {
+    sums[i] = 0;
+    counts[i] = 0;
+    averages[i] = -1;
+  }
+  battery_mv = -1;
+  current_ma[0] = current_ma[1] = -1;
+  scale_q8 = 256;
+  compensation_q8 = 256;
+}
+
+void Power_Monitor::set_pins(int battery_pin, int sense_a_pin, int sense_b_pin)
+{
+  if (pins[0] == battery_pin && pins[1] == sense_a_pin && pins[2] == sense_b_pin)
+    return;
+  pins[0] = battery_pin;
+  pins[1] = sense_a_pin;
+  pins[2] = sense_b_pin;
+  reset_readings();
+}
+
+void Power_Monitor::set_battery(int divider_x1000, int nominal_mv, int low_mv)
+{
+  this->divider_x1000 = divider_x1000;
+  this->nominal_mv = nominal_mv;
+  this->low_mv = low_mv;
+}
+
+void Power_Monitor::set_current(int sense_mohm, int budget_ma)
+{
+  this->sense_mohm = sense_mohm;
+  this->budget_ma = budget_ma;
+  if (sense_mohm == 0)
+    scale_q8 = 256;
+}
+
+bool Power_Monitor::begin(uint32_t rate_hz)
+{
+  if (timer)
+    return true;
+  const esp_timer_create_args_t args = {
+      .callback = &powerTimerCB,
+      .arg = this,
+      .dispatch_method = ESP_TIMER_TASK,
+      .name = "power",
+  };
+  if (esp_timer_create(&args, &timer) != ESP_OK)
+    return false;
+  return esp_timer_start_periodic(timer, 1000000 / rate_hz) == ESP_OK;
+}
+
+void Power_Monitor::on_timer()
+{
+  /** Next wired channel */
+  for (uint8_t i = 0; i < 3; i++)
+  {
+    channel = (channel + 1) % 3;
+    if (pins[channel] >= 0)
+      break;
+  }
+  int pin = pins[channel];
+  if (pin < 0)
+    return;
+
+  sums[channel] += analogReadMilliVolts(pin);
+  if (++counts[channel] < DECIMATION)
+    return;
+
+  int32_t block = (sums[channel] << 4) / DECIMATION;
+  sums[channel] = 0;
+  counts[channel] = 0;
+  averages[channel] = averages[channel] < 0 ? block : averages[channel] + (block - averages[channel]) / 4;
+
+  int32_t adc_mv = averages[channel] >> 4;
+  if (channel == CH_BATTERY)
+  {
+    battery_mv = adc_mv * divider_x1000 / 1000;
+    int comp = battery_mv > 0 ? nominal_mv * 256 / battery_mv : 256;
+    compensation_q8 = comp > MAX_COMPENSATION_Q8 ? MAX_COMPENSATION_Q8
+                      : comp < MIN_COMPENSATION_Q8 ? MIN_COMPENSATION_Q8 : comp;
+  }
+  else if (sense_mohm > 0)
+  {
+    /** I = U / R, mV * 1000 / mOhm = mA */
+    current_ma[channel - CH_SENSE_A] = adc_mv * 1000 / sense_mohm;
+    update_scale();
+  }
+}
+
+void Power_Monitor::update_scale()
+{
+  int total = (current_ma[0] > 0 ? current_ma[0] : 0) + (current_ma[1] > 0 ? current_ma[1] : 0);
+  int s = scale_q8;
+  if (total > budget_ma)
+  {
+    /** The averaged reading lags, so cut in steps rather than in proportion */
+    int cut = s * (total - budget_ma) / total;
+    s -= cut > s / 8 ? s / 8 : cut + 1;
+  }
+  else if (total < budget_ma * 9 / 10)
+  {
+    s += 4;
+  }
+  scale_q8 = s > 256 ? 256 : s < 16 ? 16 : s;
+}
+
+void Power_Monitor::limit(int &a, int &b, int max_duty)
+{
+  int32_t k = (int32_t)scale_q8 * compensation_q8;
+  a = (int)((a * k) >> 16);
+  b = (int)((b * k) >> 16);
+  a = a > max_duty ? max_duty : a < -max_duty ? -max_duty : a;
+  b = b > max_duty ? max_duty : b < -max_duty ? -max_duty : b;
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <Arduino.h>
+#include <esp_timer.h>
+
+// Samples the battery voltage and, where wired, the DRV8833 sense resistors
+// from an esp_timer, and limits motor duty with the result.
+//
+// Each timer tick reads one channel round robin with the calibrated oneshot
+// ADC. DECIMATION samples are averaged, then smoothed. The readings are not
+// synchronised with the PWM, so the current is its average over the period.
+//
+// limit() only uses cached values: it scales duty down while the measured
+// current is over budget (fast down, slow recovery) and scales it up as
+// the battery sags below nominal, so the same stick gives the same speed.
+// Above nominal duty is left alone. The result is clamped to the caller's
+// duty limit last, so compensation never drives past pwm_limit.
+class Power_Monitor {
+ public:
+    Power_Monitor() {
+      timer = nullptr;
+      pins[0] = pins[1] = pins[2] = -1;
+      divider_x1000 = 3000;
+      nominal_mv = 7400;
+      low_mv = 6600;
+      sense_mohm = 0;
+      budget_ma = 1500;
+      channel = 0;
+      reset_readings();
+    }
+
+    /** -1 for anything not wired */
+    void set_pins(int battery_pin, int sense_a_pin, int sense_b_pin);
+    /** divider_x1000: battery mV per 1000 ADC mV */
+    void set_battery(int divider_x1000, int nominal_mv, int low_mv);
+    /** sense_mohm 0 disables current limiting */
+    void set_current(int sense_mohm, int budget_ma);
+
+    bool begin(uint32_t rate_hz);
+    /** Scale a pair of -255..255 duties into budget, then clamp to +-max_duty */
+    void limit(int &a, int &b, int max_duty = 255);
+
+    /** -1 when not wired or not sampled yet */
+    int get_battery_mv() { return battery_mv; }
+    int get_current_ma(int motor) { return current_ma[motor & 1]; }
+    bool is_low() { return battery_mv >= 0 && battery_mv < low_mv; }
+    /** Current limit scale, 256 = no limiting */
+    int get_scale_q8() { return scale_q8; }
+
+    /** Sampler step, public for the C timer callback */
+    void on_timer();
+
+ private:
+    static const uint8_t DECIMATION = 16;
+    static const int MAX_COMPENSATION_Q8 = 384; /** at most 1.5 x duty for sag */
+    static const int MIN_COMPENSATION_Q8 = 256; /** never cut duty for a full pack */
+
+    void reset_readings();
+    void update_scale();
+
+    esp_timer_handle_t timer;
+    int pins[3];
+    int divider_x1000;
+    int nominal_mv;
+    int low_mv;
+    int sense_mohm;
+    int budget_ma;
+    uint8_t channel;
+    uint32_t sums[3];
+    uint8_t counts[3];
+    int32_t averages[3];     /** ADC mV * 16, -1 until the first block */
+    volatile int battery_mv;
+    volatile int current_ma[2];
+    volatile int scale_q8;
+    volatile int compensation_q8;
+};
@@ -0,0 +1,31 @@
+#include "Relay_Frame.h"
+#include <string.h>
+
+bool Relay_Filter::accept(const uint8_t *data, int length, uint32_t now_ms, drive_frame_t &frame)
+{
+  if (length != sizeof(drive_frame_t))
+    return false;
+  memcpy(&frame, data, sizeof(frame));
+  if (frame.magic != RELAY_FRAME_MAGIC)
+    return false;
+  if (frame.target != RELAY_ALL && address != RELAY_ALL && frame.target != address)
+    return false;
+
+  /** After a long silence the sender may have restarted, resync */
+  if (have_seq && now_ms - last_frame_ms > RELAY_RESYNC_MS)
+    have_seq = false;
+
+  /** Drop duplicates and frames that arrive out of order */
+  if (have_seq)
+  {
+    int16_t ahead = (int16_t)(frame.seq - last_seq);
+    if (ahead <= 0)
+      return false;
+    lost += ahead - 1;
+  }
+  last_seq = frame.seq;
+  have_seq = true;
+  received++;
+  last_frame_ms = now_ms;
+  return true;
+}
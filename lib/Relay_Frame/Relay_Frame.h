@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Relay frame format and the receiver's sequence rules, kept free of
+// Arduino and ESP-NOW so the fan-out can be simulated on the host.
+
+#define RELAY_ALL 0          /** target address every receiver accepts */
+#define RELAY_FLAG_STOP 0x01 /** sender lost its input, stop now */
+#define RELAY_FRAME_MAGIC 0xD5
+#define RELAY_RESYNC_MS 1000 /** silence after which any sequence number is accepted */
+
+// Compact control frame, broadcast once per report plus keepalives.
+typedef struct __attribute__((__packed__))
+{
+  uint8_t magic;
+  uint8_t target;
+  uint16_t seq;
+  int16_t x;
+  int16_t y;
+  uint8_t flags;
+} drive_frame_t;
+
+static inline void make_frame(drive_frame_t &frame, uint8_t target, uint16_t seq,
+                              int x, int y, uint8_t flags)
+{
+  frame.magic = RELAY_FRAME_MAGIC;
+  frame.target = target;
+  frame.seq = seq;
+  frame.x = x;
+  frame.y = y;
+  frame.flags = flags;
+}
+
+// Receiver side: address filtering, duplicate and out of order drops,
+// loss counting. Written from one task, the counters may be read anywhere.
+class Relay_Filter {
+ public:
+    Relay_Filter() {
+      address = RELAY_ALL;
+      reset();
+    }
+
+    void reset() {
+      last_seq = 0;
+      have_seq = false;
+      received = 0;
+      lost = 0;
+      last_frame_ms = 0;
+    }
+    /** Frames for other robots are dropped, RELAY_ALL takes everything */
+    void set_address(uint8_t a) { address = a; }
+    uint8_t get_address() { return address; }
+    /** Decode data into frame, false when it is not for us, a duplicate or late */
+    bool accept(const uint8_t *data, int length, uint32_t now_ms, drive_frame_t &frame);
+    uint32_t get_received() { return received; }
+    /** Frames skipped in the sequence */
+    uint32_t get_lost() { return lost; }
+    /** now_ms of the last accepted frame */
+    uint32_t get_last_frame_ms() { return last_frame_ms; }
+
+ private:
+    uint8_t address;
+    uint16_t last_seq;
+    bool have_seq;
+    volatile uint32_t received;
+    volatile uint32_t lost;
+    volatile uint32_t last_frame_ms;
+};
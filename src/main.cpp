@@ -1,368 +1,651 @@
 // https://lastminuteengineers.com/drv8833-arduino-tutorial/
 #include <Arduino.h>
-#include <NimBLEDevice.h>
-
-// Define the control inputs
+#include <BLE_Client_Joystick.h>
+#include <esp_timer.h>
+#include <Input_Smoother.h>
+#include <Drive_Relay.h>
+#include <Drive_Mixer.h>
+#include <Joystick_Decode.h>
+#include <Config_Store.h>
+#include <Link_Monitor.h>
+#include <Hid_Drive_Map.h>
+#include <Drive_Macro.h>
+#include <Power_Monitor.h>
+#include <Hid_Feedback.h>
+#include <Gesture_Engine.h>
+#include <Drive_Gestures.h>
+
+// Define the control inputs, defaults for the pin_* config values
 #define MOT_B2_PIN D3 // IN 4
 #define MOT_B1_PIN D4 // IN 3
 #define MOT_A2_PIN D5 // IN 2
 #define MOT_A1_PIN D6 // IN 1
 
-static const char HID_SERVICE[] = "1812";
-static const char HID_REPORT_MAP[] = "2A4B";
-static const char HID_REPORT_DATA[] = "2A4D";
-
-static const NimBLEAdvertisedDevice *advDevice;
-static bool doConnect = false;
-static uint32_t scanTimeMs = 5000; /** scan time in milliseconds, 0 = scan forever */
+// Smooth the stick reports and drive the motors from a fixed rate timer
+// instead of applying each report as a step change from loop().
+#ifndef INPUT_SMOOTHING
+#define INPUT_SMOOTHING 1
+#endif
+#define CONTROL_RATE_HZ 500
+#define RENDER_DELAY_US 15000    /** default render_delay, ~ one connection interval */
+#define MAX_EXTRAPOLATION_US 20000 /** default max_extrap, how far past the newest report we predict */
+
+// One gamepad, several robots: the sender rebroadcasts what it decodes,
+// receivers skip BLE entirely. Build each robot with its own RELAY_ADDRESS.
+#ifndef RELAY_MODE
+#define RELAY_MODE RELAY_OFF
+#endif
+#ifndef RELAY_ADDRESS
+#define RELAY_ADDRESS 1 /** 1..6 */
+#endif
+#define RELAY_KEEPALIVE_MS 50    /** sender repeats the last frame this often */
+#define RELAY_TIMEOUT_MS 500     /** receiver stops after this long without frames */
+
+// Record / replay a maneuver
+#define MACRO_ABORT_DEADZONE 40 /** moving the stick further cancels playback */
+
+// Speed gears: start + flick up / down shifts, start + a full circle goes back to the
+// top gear. The robot stands still while start is held. Holding the stick forward
+// is turbo until it returns to the centre.
+#define GEAR_COUNT 4
+static const int GEAR_PERCENT[GEAR_COUNT] = {40, 60, 80, 100};
+
+#define POWER_SAMPLE_HZ 1000 /** ADC reads per second, shared round robin by the wired channels */
+
+#define LOOP_PERIOD_MS 20 /** loop() housekeeping, BLE events wake it sooner */
+#ifndef REPORT_LOG
+#define REPORT_LOG 0 /** print every gamepad and keyboard report */
+#endif
+
+static BLE_Client_Joystick joystick;
+static Config_Store config;
+static Link_Monitor linkMonitor;
+static uint32_t linkSampleMs = 0;
+static Hid_Drive_Map hidMap;
+static Drive_Macro macro;
+static Power_Monitor power;
+static int gamepadBattery = -1; /** percent from the gamepad's Battery Service */
+static bool lowBattery = false;
+static Hid_Feedback feedback;
+static Gesture_Engine gestures;
+static int gear = GEAR_COUNT - 1;
+static bool turbo = false;
 // static bool deviceNewData = false;
-static bool startB = false;
 static int yB = 0;
 static int xB = 0;
+static uint8_t lastAxes[2] = {0, 0}; /** raw stick bytes of the last report */
+static uint32_t gestureTimeUs = 0;   /** stamp of the input gestures are evaluated for */
 static int lp = 0;
 static int rp = 0;
+#if INPUT_SMOOTHING
+static Input_Smoother smoother(RENDER_DELAY_US, MAX_EXTRAPOLATION_US);
+static portMUX_TYPE smootherMux = portMUX_INITIALIZER_UNLOCKED;
+static esp_timer_handle_t controlTimer = nullptr;
+#endif
+#if RELAY_MODE != RELAY_OFF
+static Drive_Relay relay;
+static uint8_t relayTarget = RELAY_ALL;
+static bool relayStopped = true;
+#endif
 
 void disconnectCB();
+void pushInput(uint32_t t_us);
 void set_motor_pwm(int pwm, int IN1_PIN, int IN2_PIN);
 void set_motor_currents(int pwm_A, int pwm_B);
+void configurePower(const config_t &cfg);
+void beep(uint8_t tone, int duration);
 
-/**  None of these are required as they will be handled by the library with defaults. **
- **                       Remove as you see fit for your needs                        */
-class ClientCallbacks : public NimBLEClientCallbacks
+void disconnectCB()
 {
-    void onConnect(NimBLEClient *pClient) override
-    {
-        Serial.printf("Connected\n");
-        /** After connection we should change the parameters if we don't need fast response times.
-         *  These settings are 150ms interval, 0 latency, 450ms timout.
-         *  Timeout should be a multiple of the interval, minimum is 100ms.
-         *  I find a multiple of 3-5 * the interval works best for quick response/reconnect.
-         *  Min interval: 120 * 1.25ms = 150, Max interval: 120 * 1.25ms = 150, 0 latency, 60 * 10ms = 600ms timeout
-         */
-        pClient->updateConnParams(120, 120, 0, 60);
-    }
+    macro.stop();
+    macro.stop_recording(micros());
+    xB = 0;
+    yB = 0;
+#if INPUT_SMOOTHING
+    portENTER_CRITICAL(&smootherMux);
+    smoother.reset();
+    portEXIT_CRITICAL(&smootherMux);
+#endif
+    set_motor_currents(0, 0);
+#if RELAY_MODE == RELAY_SENDER
+    relay.send(relayTarget, 0, 0, RELAY_FLAG_STOP);
+#endif
+}
 
-    void onDisconnect(NimBLEClient *pClient, int reason) override
-    {
-        disconnectCB();
-        Serial.printf("%s Disconnected, reason = %d - Starting scan\n", pClient->getPeerAddress().toString().c_str(), reason);
-        NimBLEDevice::getScan()->start(scanTimeMs, false, true);
-    }
+/** Hand the current xB, yB to the motor control path, t_us is when the input arrived */
+void pushInput(uint32_t t_us)
+{
+#if INPUT_SMOOTHING
+    portENTER_CRITICAL(&smootherMux);
+    smoother.push(t_us, xB, yB);
+    portEXIT_CRITICAL(&smootherMux);
+#endif
+}
 
-    /** Called when the peripheral requests a change to the connection parameters.
-     *  Return true to accept and apply them or false to reject and keep
-     *  the currently used parameters. Default will return true.
-     */
-    bool onConnParamsUpdateRequest(NimBLEClient *pClient,
-                                   const ble_gap_upd_params *params)
-    {
-        // Failing to accepts parameters may result in the remote device
-        // disconnecting.
-        return true;
-    }
+#if RELAY_MODE == RELAY_SENDER
+/** Switch robots, stop the one we leave instead of waiting for its timeout */
+void relaySelect(uint8_t target)
+{
+    target = target == RELAY_SELECT_MASK ? RELAY_ALL : target;
+    if (target == relayTarget)
+        return;
+    relay.send(relayTarget, 0, 0, RELAY_FLAG_STOP);
+    relayTarget = target;
+    Serial.printf("Relay target: %d\n", relayTarget);
+}
+
+/** Rebroadcast xB, yB to the target robot */
+void relayInput()
+{
+    relay.send(relayTarget, xB, yB);
 
-    /********************* Security handled here *********************/
-    /****** Note: these are the same return values as defaults ********/
-    uint32_t onPassKeyRequest()
+    /** Our own motors only follow when we are addressed */
+    if (relayTarget != RELAY_ALL && relayTarget != RELAY_ADDRESS)
     {
-        Serial.println("Client Passkey Request");
-        /** return the passkey to send to the server */
-        return 123456;
+        xB = 0;
+        yB = 0;
     }
+}
+#endif
 
-    void onPassKeyEntry(NimBLEConnInfo &connInfo) override
+#if RELAY_MODE == RELAY_RECEIVER
+/** Runs in the WiFi task for every accepted frame */
+void relayFrameCB(const drive_frame_t &frame)
+{
+    if (frame.flags & RELAY_FLAG_STOP)
     {
-        Serial.printf("Server Passkey Entry\n");
-        /**
-         * This should prompt the user to enter the passkey displayed
-         * on the peer device.
-         */
-        NimBLEDevice::injectPassKey(connInfo, 123456);
+        if (!relayStopped)
+            disconnectCB();
+        relayStopped = true;
+        return;
     }
+    relayStopped = false;
+    xB = frame.x;
+    yB = frame.y;
+    pushInput(micros());
+}
+#endif
 
-    void onConfirmPasskey(NimBLEConnInfo &connInfo, uint32_t pass_key) override
+#if RELAY_MODE != RELAY_OFF
+void setupRelay()
+{
+    relay.set_address(RELAY_ADDRESS);
+#if RELAY_MODE == RELAY_RECEIVER
+    relay.set_frame_callback(relayFrameCB);
+#endif
+    if (!relay.begin())
+        return;
+#if RELAY_MODE == RELAY_SENDER
+    relay.send(RELAY_ALL, 0, 0, RELAY_FLAG_STOP);
+#endif
+    Serial.printf("Relay started, mode %d, address %d\n", RELAY_MODE, RELAY_ADDRESS);
+}
+#endif
+
+/** Start or end a recording */
+void macroRecord(uint32_t now)
+{
+    if (macro.is_full())
     {
-        Serial.printf("The passkey YES/NO number: %" PRIu32 "\n", pass_key);
-        /** Inject false if passkeys don't match. */
-        NimBLEDevice::injectConfirmPasskey(connInfo, true);
+        /** Closed and saved when the buffer filled, the chord only acknowledges it */
+        macro.stop_recording(now);
+        feedback.leds(0);
     }
-
-    bool onConfirmPIN(uint32_t pass_key)
+    else if (macro.is_recording())
     {
-        Serial.print("The passkey YES/NO number: ");
-        Serial.println(pass_key);
-        /** Return false if passkeys don't match. */
-        return true;
+        macro.stop_recording(now);
+        macro.save();
+        feedback.leds(0);
+        Serial.printf("Macro recorded: %u frames, %u bytes, %" PRIu32 " ms\n",
+                      macro.get_frames(), (unsigned)macro.get_size(), macro.get_duration_us() / 1000);
     }
-
-    /** Pairing process complete, we can check the results in connInfo */
-    void onAuthenticationComplete(NimBLEConnInfo &connInfo) override
+    else if (macro.start_recording(now))
     {
-        if (!connInfo.isEncrypted())
-        {
-            Serial.printf("Encrypt connection failed - disconnecting\n");
-            /** Find the client with the connection handle provided in connInfo */
-            NimBLEDevice::getClientByHandle(connInfo.getConnHandle())->disconnect();
-            return;
-        }
+        Serial.printf("Macro recording\n");
+        feedback.leds(2);
+        feedback.rumble(30, 100);
     }
-} clientCallbacks;
+}
 
-/** Define a class to handle the callbacks when scan events are received */
-class ScanCallbacks : public NimBLEScanCallbacks
+/** The buffer filled up and closed the take: keep it and tell the operator.
+ *  The recording LED stays on until the record chord acknowledges it. */
+void macroFull()
 {
-    void onResult(const NimBLEAdvertisedDevice *advertisedDevice) override
-    {
-        Serial.printf("Advertised Device found: %s\n", advertisedDevice->toString().c_str());
-        if (advertisedDevice->isAdvertisingService(NimBLEUUID(HID_SERVICE)))
-        {
-            Serial.printf("Found Our Service: %\n", advertisedDevice->toString().c_str());
-            /** stop scan before connecting */
-            NimBLEDevice::getScan()->stop();
-            /** Save the device reference in a global for the client to use*/
-            advDevice = advertisedDevice;
-            /** Ready to connect now */
-            doConnect = true;
-        }
-    }
+    macro.save();
+    feedback.rumble(100, 400);
+    Serial.printf("Macro buffer full: %u frames, %u bytes, %" PRIu32 " ms\n",
+                  macro.get_frames(), (unsigned)macro.get_size(), macro.get_duration_us() / 1000);
+}
+
+/** Play the recording, or stop it */
+void macroPlay()
+{
+    if (macro.is_playing())
+        macro.stop();
+    else if (macro.play())
+        Serial.printf("Macro playing\n");
+}
 
-    /** Callback to process the results of the completed scan or restart it */
-    void onScanEnd(const NimBLEScanResults &results, int reason) override
+/** Recording and playback abort. True while a take is playing. */
+bool macroInput(uint32_t now)
+{
+    if (macro.is_playing())
     {
-        Serial.printf("Scan Ended, reason: %d, device count: %d; Restarting scan\n", reason, results.getCount());
-        NimBLEDevice::getScan()->start(scanTimeMs, false, true);
+        if (abs(xB) < MACRO_ABORT_DEADZONE && abs(yB) < MACRO_ABORT_DEADZONE)
+            return true;
+        /** The operator takes over, this report replaces the final stop */
+        macro.stop(false);
     }
-} scanCallbacks;
+    if (!macro.record(now, xB, yB))
+        macroFull();
+    return false;
+}
 
-void disconnectCB()
+void shiftGear(int newGear)
 {
-    set_motor_currents(0, 0);
+    newGear = constrain(newGear, 0, GEAR_COUNT - 1);
+    if (newGear == gear)
+        return;
+    gear = newGear;
+    Serial.printf("Gear %d, %d%%\n", gear + 1, GEAR_PERCENT[gear]);
+    feedback.rumble(20 + 20 * gear, 80);
 }
 
-/** Notification / Indication receiving handler callback */
-// WARNING: This device has 4 Characteristics = 0x2a4d but with different
-// handle values.
-void notifyCB(NimBLERemoteCharacteristic *pRemoteCharacteristic, uint8_t *pData, size_t length, bool isNotify)
+/** Runs in loop(), from gestures.update() or gestures.tick() */
+void gestureActionCB(uint8_t action, uint8_t arg)
 {
-    std::string str = (isNotify == true) ? "Notification" : "Indication";
-    str += " from handle ";
-    str += std::to_string(pRemoteCharacteristic->getHandle());
-    // str += ": Service = " + pRemoteCharacteristic->getRemoteService()->getUUID().toString();
-    // str += ", Characteristic = " + pRemoteCharacteristic->getUUID().toString();
-    str += ", Value = ";
-    for (size_t i = 0; i < length; i++)
+    switch (action)
     {
-        uint8_t d = pData[i];
-        str += std::to_string(d) + ", ";
+    case ACTION_MACRO_RECORD:
+        /** Same clock as the frames: a report stamp, never later than them */
+        macroRecord(gestureTimeUs);
+        break;
+    case ACTION_MACRO_PLAY:
+        macroPlay();
+        break;
+    case ACTION_GEAR_UP:
+        shiftGear(gear + 1);
+        break;
+    case ACTION_GEAR_DOWN:
+        shiftGear(gear - 1);
+        break;
+    case ACTION_GEAR_RESET:
+        shiftGear(GEAR_COUNT - 1);
+        break;
+    case ACTION_TURBO_ON:
+        turbo = true;
+        Serial.printf("Turbo\n");
+        break;
+    case ACTION_TURBO_OFF:
+        turbo = false;
+        break;
+#if RELAY_MODE == RELAY_SENDER
+    case ACTION_RELAY_TARGET:
+        relaySelect(arg);
+        break;
+#endif
     }
+}
 
-    startB = pData[5] == 8;
+void setupGestures()
+{
+    gestures.set_action_callback(gestureActionCB);
+    load_drive_gestures(gestures, RELAY_MODE == RELAY_SENDER);
+}
 
-    if (pData[0] == 128)
-        yB = 0;
-    else if (pData[0] < 128)
-        yB = (abs(pData[0] - 128) << 1) - 1;
-    else
-        yB = (-(pData[0] - 128) << 1) - 1;
+/** Runs in the esp_timer task for every recorded change */
+void macroFrameCB(int x, int y)
+{
+    xB = x;
+    yB = y;
+#if RELAY_MODE == RELAY_SENDER
+    relayInput();
+#endif
+    pushInput(micros());
+}
 
-    if (pData[1] == 128)
+/** Gamepad input report, dispatched from loop() */
+void handleReport(const ble_event_t &event)
+{
+    const uint8_t *pData = event.data;
+    if (event.length < 6)
+        return;
+    /** Only a moving stick makes the pad notify every interval */
+    bool moving = pData[0] != lastAxes[0] || pData[1] != lastAxes[1];
+    lastAxes[0] = pData[0];
+    lastAxes[1] = pData[1];
+    linkMonitor.on_notify(event.t_us, moving);
+
+    yB = decode_axis(pData[0]);
+    xB = decode_axis(pData[1]);
+    /** Gestures see the stick before any scaling */
+    gestureTimeUs = event.t_us;
+    gestures.update(millis(), pData[5], xB, yB);
+    /** With start held the stick shifts gears, it does not drive */
+    if (pData[5] & START_BUTTON)
+    {
         xB = 0;
-    else if (pData[1] < 128)
-        xB = (abs(pData[1] - 128) << 1) - 1;
-    else
-        xB = (-(pData[1] - 128) << 1) - 1;
+        yB = 0;
+    }
 
-    str += ", yB = " + std::to_string(yB);
-    str += ", xB = " + std::to_string(xB);
+    int scale = config.snapshot()->axis_scale * (turbo ? 100 : GEAR_PERCENT[gear]) / 100;
+    if (scale != 100)
+    {
+        yB = constrain(yB * scale / 100, -255, 255);
+        xB = constrain(xB * scale / 100, -255, 255);
+    }
 
-    Serial.printf("%s\n", str.c_str());
+    if (!macroInput(event.t_us))
+    {
+#if RELAY_MODE == RELAY_SENDER
+        relayInput();
+#endif
+        pushInput(event.t_us);
+    }
 
-    // deviceNewData = true;
+#if REPORT_LOG
+    Serial.printf("Report from handle %d, %d bytes, button %d, yB = %d, xB = %d\n",
+                  event.handle, event.length, pData[5], yB, xB);
+#endif
 }
 
-/** Handles the provisioning of clients and connects / interfaces with the server */
-bool connectToServer()
+/** Hand the keyboard / mouse setpoint to the same path as the stick */
+void applyMappedInput(uint32_t t_us)
 {
-    NimBLEClient *pClient = nullptr;
+    xB = hidMap.get_x();
+    yB = hidMap.get_y();
+#if RELAY_MODE == RELAY_SENDER
+    relayInput();
+#endif
+    pushInput(t_us);
+}
 
-    /** Check if we have a client we should reuse first **/
-    if (NimBLEDevice::getCreatedClientCount())
+/** Boot protocol keyboard, presenter and mouse reports */
+void handleBootReport(const ble_event_t &event)
+{
+    /** Keys do not repeat, a mouse only reports while it moves */
+    linkMonitor.on_notify(event.t_us, event.type == BLE_EV_MOUSE);
+    if (event.type == BLE_EV_KEYBOARD && hidMap.on_keyboard(event.data, event.length))
     {
-        /**
-         *  Special case when we already know this device, we send false as the
-         *  second argument in connect() to prevent refreshing the service database.
-         *  This saves considerable time and power.
-         */
-        pClient = NimBLEDevice::getClientByPeerAddress(advDevice->getAddress());
-        if (pClient)
-        {
-            if (!pClient->connect(advDevice, false))
-            {
-                Serial.printf("Reconnect failed\n");
-                return false;
-            }
-            Serial.printf("Reconnected client\n");
-        }
-        else
-        {
-            /**
-             *  We don't already have a client that knows this device,
-             *  check for a client that is disconnected that we can use.
-             */
-            pClient = NimBLEDevice::getDisconnectedClient();
-        }
+        applyMappedInput(event.t_us);
+#if REPORT_LOG
+        Serial.printf("Keyboard: yB = %d, xB = %d\n", yB, xB);
+#endif
     }
-
-    /** No client to reuse? Create a new one. */
-    if (!pClient)
+    else if (event.type == BLE_EV_MOUSE && hidMap.on_mouse(event.data, event.length))
     {
-        if (NimBLEDevice::getCreatedClientCount() >= NIMBLE_MAX_CONNECTIONS)
-        {
-            Serial.printf("Max clients reached - no more connections available\n");
-            return false;
-        }
-
-        pClient = NimBLEDevice::createClient();
-
-        Serial.printf("New client created\n");
-
-        pClient->setClientCallbacks(&clientCallbacks, false);
-        /**
-         *  Set initial connection parameters:
-         *  These settings are safe for 3 clients to connect reliably, can go faster if you have less
-         *  connections. Timeout should be a multiple of the interval, minimum is 100ms.
-         *  Min interval: 12 * 1.25ms = 15, Max interval: 12 * 1.25ms = 15, 0 latency, 51 * 10ms = 510ms timeout
-         */
-        pClient->setConnectionParams(12, 12, 0, 51);
-
-        /** Set how long we are willing to wait for the connection to complete (milliseconds), default is 30000. */
-        pClient->setConnectTimeout(5 * 1000);
-
-        if (!pClient->connect(advDevice))
-        {
-            /** Created a client but failed to connect, don't need to keep it as it has no data */
-            NimBLEDevice::deleteClient(pClient);
-            Serial.printf("Failed to connect, deleted client\n");
-            return false;
-        }
+        applyMappedInput(event.t_us);
     }
+}
 
-    if (!pClient->isConnected())
+/** Runs in loop() via feedback.pump(), at most once per connection interval */
+bool feedbackWrite(uint8_t kind, const uint8_t *data, size_t length)
+{
+    return joystick.write_output(kind == FEEDBACK_RUMBLE ? BLE_OUT_RUMBLE : BLE_OUT_LED, data, length);
+}
+
+/** Request the PHY and connection parameters of the current link profile */
+void applyLinkProfile()
+{
+    const config_t *cfg = config.snapshot();
+    link_params_t normal = {LINK_PHY_1M_MASK, 0, (uint16_t)cfg->conn_itvl,
+                            (uint16_t)cfg->conn_latency, (uint16_t)cfg->conn_tmo};
+    link_params_t p = linkMonitor.get_params(linkMonitor.get_profile(), normal);
+    Serial.printf("Link profile %d: phy mask %d, interval %d, timeout %d\n",
+                  linkMonitor.get_profile(), p.phy_mask, p.itvl, p.tmo);
+
+    if (linkMonitor.phy_to_mask(linkMonitor.get_phy()) != p.phy_mask)
     {
-        if (!pClient->connect(advDevice))
-        {
-            Serial.printf("Failed to connect\n");
-            return false;
-        }
+        linkMonitor.on_phy_requested(p.phy_mask);
+        joystick.update_phy(p.phy_mask, p.phy_options);
     }
+    joystick.update_conn_params(p.itvl, p.latency, p.tmo);
+}
 
-    Serial.printf("Connected to: %s RSSI: %d\n",
-                  pClient->getPeerAddress().toString().c_str(),
-                  pClient->getRssi());
+/** Sample RSSI and the connection interval, adapt the link when needed */
+void monitorLink()
+{
+    uint32_t now = millis();
+    if (now - linkSampleMs < (uint32_t)config.snapshot()->link_sample_ms)
+        return;
+    linkSampleMs = now;
+    if (!joystick.is_connected())
+        return;
+
+    linkMonitor.on_params(joystick.get_conn_interval());
+    if (linkMonitor.on_rssi(joystick.get_rssi(), now))
+    {
+        applyLinkProfile();
+        /** Warn the operator the link is about to give out */
+        if (linkMonitor.get_profile() == LINK_FAR)
+            feedback.rumble(60, 300);
+    }
+    feedback.set_interval_us(linkMonitor.get_itvl() * 1250UL);
+}
 
-    /** Now we can read/write/subscribe the characteristics of the services we are interested in */
-    NimBLERemoteService *pSvc = nullptr;
+/** Warn once when the battery drops below batt_low_mv */
+void monitorPower()
+{
+    bool low = power.is_low();
+    if (low && !lowBattery)
+    {
+        Serial.printf("Battery low: %d mV\n", power.get_battery_mv());
+        feedback.rumble(100, 1000);
+        feedback.leds(7);
+    }
+    lowBattery = low;
+}
 
-    pSvc = pClient->getService(HID_SERVICE);
-    /** make sure it's not null */
-    if (pSvc)
+/** Serial commands beyond the config ones */
+bool commandCB(const char *cmd, const char *arg, Print &out)
+{
+    if (strcmp(cmd, "power") == 0)
+    {
+        out.printf("battery_mv=%d current_a_ma=%d current_b_ma=%d scale_q8=%d gamepad_pct=%d%s\n",
+                   power.get_battery_mv(), power.get_current_ma(0), power.get_current_ma(1),
+                   power.get_scale_q8(), gamepadBattery, power.is_low() ? " low" : "");
+        return true;
+    }
+    if (strcmp(cmd, "link") == 0)
+    {
+        linkMonitor.print_records(out);
+        out.printf("dropped_events=%" PRIu32 "\n", joystick.get_dropped_events());
+        return true;
+    }
+    if (strcmp(cmd, "macro") == 0)
     {
-        // Subscribe to characteristics HID_REPORT_DATA.
-        // One real device reports 2 with the same UUID but
-        // different handles. Using getCharacteristic() results
-        // in subscribing to only one.
-        const std::vector<NimBLERemoteCharacteristic *> &charvector = pSvc->getCharacteristics(true);
-        for (auto &it : charvector)
-        {
-            if (it->getUUID() == NimBLEUUID(HID_REPORT_DATA))
-            {
-                Serial.printf("Subscribe to characteristics HID_REPORT_DATA: %s  \n",
-                              it->toString().c_str());
-
-                if (it->canNotify())
-                {
-                    if (!it->subscribe(true, notifyCB))
-                    {
-                        /** Disconnect if subscribe failed */
-                        Serial.println("subscribe notification failed");
-                        pClient->disconnect();
-                        return false;
-                    }
-                }
-            }
-        }
+        bool ok = true;
+        if (arg && strcmp(arg, "play") == 0)
+            ok = macro.play();
+        else if (arg && strcmp(arg, "stop") == 0)
+            macro.stop();
+        else if (arg && strcmp(arg, "save") == 0)
+            ok = macro.save();
+        else if (arg && strcmp(arg, "load") == 0)
+            ok = macro.load();
+        out.printf("%s macro frames=%u size=%u duration_ms=%" PRIu32 "%s%s\n", ok ? "ok" : "err",
+                   macro.get_frames(), (unsigned)macro.get_size(), macro.get_duration_us() / 1000,
+                   macro.is_recording() ? " recording" : "", macro.is_playing() ? " playing" : "");
+        return true;
     }
+    return false;
+}
 
-    Serial.printf("Done with this device!\n");
-    return true;
+/** Scan and connection parameters from the config */
+ble_client_params_t bleParams(const config_t &cfg)
+{
+    ble_client_params_t p;
+    p.scan_interval_ms = cfg.scan_interval_ms;
+    p.scan_window_ms = cfg.scan_window_ms;
+    p.scan_time_ms = cfg.scan_time_ms;
+    p.conn_init_itvl = cfg.conn_init_itvl;
+    p.conn_init_tmo = cfg.conn_init_tmo;
+    p.conn_itvl = cfg.conn_itvl;
+    p.conn_latency = cfg.conn_latency;
+    p.conn_tmo = cfg.conn_tmo;
+    return p;
+}
+
+/** Runs in the BLE task, stops the motors before the event reaches loop() */
+void connectCB(bool connected)
+{
+    if (!connected)
+        disconnectCB();
 }
 
 void setupBLE()
 {
     Serial.printf("Starting NimBLE Client\n");
+    joystick.set_connect_callback(connectCB);
+    joystick.begin(bleParams(*config.snapshot()));
+}
 
-    /** Initialize NimBLE, no device name spcified as we are not advertising */
-    NimBLEDevice::init("");
-
-    /**
-     * Set the IO capabilities of the device, each option will trigger a different pairing method.
-     *  BLE_HS_IO_KEYBOARD_ONLY   - Passkey pairing
-     *  BLE_HS_IO_DISPLAY_YESNO   - Numeric comparison pairing
-     *  BLE_HS_IO_NO_INPUT_OUTPUT - DEFAULT setting - just works pairing
-     */
-    // NimBLEDevice::setSecurityIOCap(BLE_HS_IO_KEYBOARD_ONLY); // use passkey
-    // NimBLEDevice::setSecurityIOCap(BLE_HS_IO_DISPLAY_YESNO); //use numeric comparison
-
-    /**
-     * 2 different ways to set security - both calls achieve the same result.
-     *  no bonding, no man in the middle protection, BLE secure connections.
-     *  These are the default values, only shown here for demonstration.
-     */
-    NimBLEDevice::setSecurityAuth(true, false, true);
-
-    // NimBLEDevice::setSecurityAuth(/*BLE_SM_PAIR_AUTHREQ_BOND | BLE_SM_PAIR_AUTHREQ_MITM |*/ BLE_SM_PAIR_AUTHREQ_SC);
+/** Everything the BLE client reports, in the order it happened */
+void handleEvent(const ble_event_t &event)
+{
+    switch (event.type)
+    {
+    case BLE_EV_REPORT:
+        handleReport(event);
+        break;
+    case BLE_EV_KEYBOARD:
+    case BLE_EV_MOUSE:
+        handleBootReport(event);
+        break;
+    case BLE_EV_CONNECTED:
+        linkMonitor.on_connect(joystick.get_conn_interval());
+        hidMap.reset();
+        beep(7, 100);
+        beep(25, 200);
+        beep(7, 100);
+        feedback.rumble(50, 200);
+        feedback.leds(lowBattery ? 7 : 0);
+        break;
+    case BLE_EV_DISCONNECTED:
+        feedback.clear();
+        linkMonitor.on_disconnect(event.value);
+        gestures.reset();
+        turbo = false;
+        gamepadBattery = -1;
+        break;
+    case BLE_EV_BATTERY:
+        gamepadBattery = event.value;
+        Serial.printf("Gamepad battery: %d%%\n", gamepadBattery);
+        break;
+    case BLE_EV_PHY:
+        linkMonitor.on_phy_update(event.value >> 8, event.value & 0xFF);
+        break;
+    }
+}
 
-    /** Optional: set the transmit power */
-    NimBLEDevice::setPower(ESP_PWR_LVL_P9); /** +9db */
+void setupMotors()
+{
+    const config_t *cfg = config.snapshot();
+    // Set all the motor control inputs to OUTPUT
+    pinMode(cfg->pin_a1, OUTPUT);
+    pinMode(cfg->pin_a2, OUTPUT);
+    pinMode(cfg->pin_b1, OUTPUT);
+    pinMode(cfg->pin_b2, OUTPUT);
 
-    /** Optional: set any devices you don't want to get advertisments from */
-    // NimBLEDevice::addIgnored(NimBLEAddress ("aa:bb:cc:dd:ee:ff"));
+    // Turn off motors - Initial state
+    analogWrite(cfg->pin_a1, LOW);
+    analogWrite(cfg->pin_a2, LOW);
+    analogWrite(cfg->pin_b1, LOW);
+    analogWrite(cfg->pin_b2, LOW);
+}
 
-    /** create new scan */
-    NimBLEScan *pScan = NimBLEDevice::getScan();
+config_t configDefaults()
+{
+    config_t c = {};
+    c.scan_interval_ms = 100;
+    c.scan_window_ms = 100;
+    c.scan_time_ms = 5000;
+    c.conn_init_itvl = 12;
+    c.conn_init_tmo = 51;
+    c.conn_itvl = 120;
+    c.conn_latency = 0;
+    c.conn_tmo = 60;
+    c.pwm_limit = 255;
+    c.axis_scale = 100;
+    c.pin_a1 = MOT_A1_PIN;
+    c.pin_a2 = MOT_A2_PIN;
+    c.pin_b1 = MOT_B1_PIN;
+    c.pin_b2 = MOT_B2_PIN;
+    c.render_delay_us = RENDER_DELAY_US;
+    c.max_extrap_us = MAX_EXTRAPOLATION_US;
+    c.link_near_rssi = -60;
+    c.link_far_rssi = -85;
+    c.link_sample_ms = 500;
+    c.pin_batt = -1;
+    c.pin_sense_a = -1;
+    c.pin_sense_b = -1;
+    c.batt_divider = 3000;
+    c.batt_nominal_mv = 7400;
+    c.batt_low_mv = 6600;
+    c.sense_mohm = 0;
+    c.current_budget_ma = 1500;
+    return c;
+}
 
-    /** Set the callbacks to call when scan events occur, no duplicates */
-    pScan->setScanCallbacks(&scanCallbacks, false);
+/** Runs in loop() after a "set", "load" or "defaults" command */
+void configChangedCB(const config_t &old_config, const config_t &new_config)
+{
+    if (old_config.pin_a1 != new_config.pin_a1 || old_config.pin_a2 != new_config.pin_a2 ||
+        old_config.pin_b1 != new_config.pin_b1 || old_config.pin_b2 != new_config.pin_b2)
+    {
+        /** Release the old pins before driving the new ones */
+        set_motor_pwm(0, old_config.pin_a1, old_config.pin_a2);
+        set_motor_pwm(0, old_config.pin_b1, old_config.pin_b2);
+        setupMotors();
+    }
+    linkMonitor.set_thresholds(new_config.link_near_rssi, new_config.link_far_rssi);
+    configurePower(new_config);
+    joystick.set_params(bleParams(new_config));
+}
 
-    /** Set scan interval (how often) and window (how long) in milliseconds */
-    pScan->setInterval(100);
-    pScan->setWindow(100);
+void configurePower(const config_t &cfg)
+{
+    power.set_pins(cfg.pin_batt, cfg.pin_sense_a, cfg.pin_sense_b);
+    power.set_battery(cfg.batt_divider, cfg.batt_nominal_mv, cfg.batt_low_mv);
+    power.set_current(cfg.sense_mohm, cfg.current_budget_ma);
+}
 
-    /**
-     * Active scan will gather scan response data from advertisers
-     *  but will use more energy from both devices
-     */
-    pScan->setActiveScan(true);
+#if INPUT_SMOOTHING
+/** Runs at CONTROL_RATE_HZ from the esp_timer task */
+void controlTimerCB(void *arg)
+{
+    static uint32_t configVersion = UINT32_MAX;
+    const config_t *cfg = config.snapshot();
+    int x, y;
+    portENTER_CRITICAL(&smootherMux);
+    if (cfg->version != configVersion)
+    {
+        smoother.set_render_delay(cfg->render_delay_us);
+        smoother.set_max_extrapolation(cfg->max_extrap_us);
+        configVersion = cfg->version;
+    }
+    smoother.sample(micros(), x, y);
+    portEXIT_CRITICAL(&smootherMux);
 
-    /** Start scanning for advertisers */
-    pScan->start(scanTimeMs);
-    Serial.printf("Scanning for peripherals\n");
+    /** Extrapolation may step past full scale */
+    x = constrain(x, -255, 255);
+    y = constrain(y, -255, 255);
+    mix_drive(x, y, lp, rp, cfg->pwm_limit);
+    set_motor_currents(lp, rp);
 }
 
-void setupMotors()
+void setupControlTimer()
 {
-    // Set all the motor control inputs to OUTPUT
-    pinMode(MOT_A1_PIN, OUTPUT);
-    pinMode(MOT_A2_PIN, OUTPUT);
-    pinMode(MOT_B1_PIN, OUTPUT);
-    pinMode(MOT_B2_PIN, OUTPUT);
-
-    // Turn off motors - Initial state
-    analogWrite(MOT_A1_PIN, LOW);
-    analogWrite(MOT_A2_PIN, LOW);
-    analogWrite(MOT_B1_PIN, LOW);
-    analogWrite(MOT_B2_PIN, LOW);
+    const esp_timer_create_args_t args = {
+        .callback = &controlTimerCB,
+        .arg = nullptr,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "control",
+    };
+    esp_timer_create(&args, &controlTimer);
+    esp_timer_start_periodic(controlTimer, 1000000 / CONTROL_RATE_HZ);
 }
+#endif
 
 void set_motor_pwm(int pwm, int IN1_PIN, int IN2_PIN)
 {
@@ -378,69 +661,101 @@ void set_motor_pwm(int pwm, int IN1_PIN, int IN2_PIN)
     }
 }
 
+/** Duty goes through the power limiter: current budget and sag compensation,
+ *  clamped to pwm_limit after both */
 void set_motor_currents(int pwm_A, int pwm_B)
 {
-    set_motor_pwm(pwm_A, MOT_A1_PIN, MOT_A2_PIN);
-    set_motor_pwm(pwm_B, MOT_B1_PIN, MOT_B2_PIN);
+    const config_t *cfg = config.snapshot();
+    power.limit(pwm_A, pwm_B, cfg->pwm_limit);
+    set_motor_pwm(pwm_A, cfg->pin_a1, cfg->pin_a2);
+    set_motor_pwm(pwm_B, cfg->pin_b1, cfg->pin_b2);
 }
 
 void beep(uint8_t tone, int duration)
 {
+#if INPUT_SMOOTHING
+    /** Keep the control timer from overwriting the tone */
+    if (controlTimer)
+        esp_timer_stop(controlTimer);
+#endif
     set_motor_currents(tone, tone);
     delay(duration);
     set_motor_currents(0, 0);
+#if INPUT_SMOOTHING
+    if (controlTimer)
+        esp_timer_start_periodic(controlTimer, 1000000 / CONTROL_RATE_HZ);
+#endif
 }
 
 void setup()
 {
     Serial.begin(115200);
+    config.begin(configDefaults());
+    config.set_changed_callback(configChangedCB);
+    config.set_command_callback(commandCB);
+    macro.set_frame_callback(macroFrameCB);
+    setupGestures();
+    feedback.set_writer(feedbackWrite);
+    macro.load();
+    configurePower(*config.snapshot());
+    power.begin(POWER_SAMPLE_HZ);
+    linkMonitor.set_thresholds(config.snapshot()->link_near_rssi, config.snapshot()->link_far_rssi);
     setupMotors();
+#if RELAY_MODE != RELAY_OFF
+    setupRelay();
+#endif
+#if RELAY_MODE != RELAY_RECEIVER
     setupBLE();
+#endif
 
     beep(20, 100);
+#if INPUT_SMOOTHING
+    setupControlTimer();
+#endif
 }
 
 void loop()
 {
-    /** Loop here until we find a device we want to connect to */
-    delay(20);
-
-    if (doConnect)
+    /** Sleep until the next BLE event, or LOOP_PERIOD_MS for the housekeeping below */
+    ble_event_t event;
+    if (joystick.poll(event, LOOP_PERIOD_MS))
     {
-        doConnect = false;
-        /** Found a device we want to connect to, do it now */
-        if (connectToServer())
-        {
-            beep(7, 100);
-            beep(25, 200);
-            beep(7, 100);
-            Serial.printf("Success! we should now be getting notifications!\n");
-        }
-        else
-        {
-            Serial.printf("Failed to connect, starting scan\n");
-            NimBLEDevice::getScan()->start(scanTimeMs, false, true);
-        }
+        handleEvent(event);
+        while (joystick.poll(event))
+            handleEvent(event);
     }
-
-    // set_motor_currents(yB, yB);
-
-    if (xB > 0)
+    config.poll(Serial);
+    monitorLink();
+    monitorPower();
+    if (joystick.is_connected())
+        feedback.pump(micros());
+    if (joystick.is_boot_device() && joystick.is_connected() && hidMap.tick(millis()))
+        applyMappedInput(micros());
+    else if (joystick.is_connected())
     {
-        lp = yB + xB;
-        rp = yB - xB;
-        lp = lp > 255 ? 255 : lp;
-        rp = rp < -255 ? -255 : rp;
+        gestureTimeUs = micros();
+        gestures.tick(millis());
     }
-    else
+
+#if RELAY_MODE == RELAY_SENDER
+    if (millis() - relay.get_last_frame_ms() >= RELAY_KEEPALIVE_MS)
+        relay.keepalive();
+#elif RELAY_MODE == RELAY_RECEIVER
+    /** Same rule as a lost BLE link: no frames for a while, stop */
+    if (!relayStopped && millis() - relay.get_last_frame_ms() > RELAY_TIMEOUT_MS)
     {
-        lp = yB + xB;
-        rp = yB + abs(xB);
-        lp = lp < -255 ? -255 : lp;
-        rp = rp > 255 ? 255 : rp;
+        Serial.printf("Relay timeout, %" PRIu32 " frames lost\n", relay.get_lost());
+        disconnectCB();
+        relayStopped = true;
     }
+#endif
+
+    // set_motor_currents(yB, yB);
 
+#if !INPUT_SMOOTHING
+    mix_drive(xB, yB, lp, rp, config.snapshot()->pwm_limit);
     set_motor_currents(lp, rp);
+#endif
 
     // if (deviceNewData)
     // {
@@ -0,0 +1,216 @@
+#include <unity.h>
+#include <Gesture_Engine.h>
+
+// Host tests for Gesture_Engine: chords, stick gestures and sequences fed
+// as decoded reports, the action callback records what fired.
+
+#define START 0x08
+#define SELECT 0x10
+#define B1 0x20
+
+enum TEST_ACTIONS {
+  ACTION_CHORD = 1,
+  ACTION_EXACT,
+  ACTION_FLICK,
+  ACTION_HOLD,
+  ACTION_CCW,
+  ACTION_CW,
+  ACTION_SEQUENCE
+};
+
+#define FIRED_MAX 16
+
+static uint8_t fired[FIRED_MAX];
+static int fired_count;
+
+static void record_action(uint8_t action, uint8_t arg)
+{
+  if (fired_count < FIRED_MAX)
+    fired[fired_count] = action;
+  fired_count++;
+}
+
+static int count_of(uint8_t action)
+{
+  int n = 0;
+  for (int i = 0; i < fired_count && i < FIRED_MAX; i++)
+    n += fired[i] == action;
+  return n;
+}
+
+/** Stick at the rim in each GESTURE_DIRS, up and left positive */
+static const int RIM_X[8] = {0, 180, 255, 180, 0, -180, -255, -180};
+static const int RIM_Y[8] = {255, 180, 0, -180, -255, -180, 0, 180};
+
+static Gesture_Engine engine;
+
+void setUp(void)
+{
+  engine.clear();
+  engine.set_action_callback(record_action);
+  fired_count = 0;
+}
+
+void tearDown(void) {}
+
+void test_chord_fires_once_when_pressed_in_one_report(void)
+{
+  engine.add_rule(gesture_chord(START | SELECT, false, ACTION_CHORD));
+  /** Both buttons land in one report: only the lowest completes the chord */
+  engine.update(0, START | SELECT, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_CHORD));
+  engine.update(20, 0, 0, 0);
+
+  /** One after the other: the second press completes it, whichever it is */
+  engine.update(40, SELECT, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_CHORD));
+  engine.update(60, SELECT | START, 0, 0);
+  TEST_ASSERT_EQUAL_INT(2, count_of(ACTION_CHORD));
+
+  /** Holding it fires nothing more, nor does a release */
+  engine.update(80, SELECT | START, 0, 0);
+  engine.update(100, START, 0, 0);
+  TEST_ASSERT_EQUAL_INT(2, count_of(ACTION_CHORD));
+}
+
+void test_exact_chord_rejects_extra_buttons(void)
+{
+  engine.add_rule(gesture_chord(START | SELECT, true, ACTION_EXACT));
+  engine.add_rule(gesture_chord(START | SELECT, false, ACTION_CHORD));
+
+  engine.update(0, START | SELECT, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_EXACT));
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_CHORD));
+  engine.update(20, 0, 0, 0);
+
+  /** A third button down: only the subset chord matches */
+  engine.update(40, B1, 0, 0);
+  engine.update(60, B1 | START | SELECT, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_EXACT));
+  TEST_ASSERT_EQUAL_INT(2, count_of(ACTION_CHORD));
+}
+
+void test_flick_and_hold_are_told_apart_by_time(void)
+{
+  engine.add_rule(gesture_on(GESTURE_FLICK(GESTURE_UP), START, ACTION_FLICK));
+  engine.add_rule(gesture_on(GESTURE_HOLD(GESTURE_UP), 0, ACTION_HOLD));
+
+  /** Out and back well inside flick_ms, start held */
+  engine.update(0, START, 0, 0);
+  engine.update(20, START, 0, 255);
+  engine.update(120, START, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_FLICK));
+  TEST_ASSERT_EQUAL_INT(0, count_of(ACTION_HOLD));
+
+  /** The same flick without start does not match the rule */
+  engine.update(200, 0, 0, 255);
+  engine.update(300, 0, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_FLICK));
+
+  /** Kept at the rim: a hold from tick(), once, and no flick on the way back */
+  engine.update(400, START, 0, 255);
+  engine.tick(900);
+  TEST_ASSERT_EQUAL_INT(0, count_of(ACTION_HOLD));
+  engine.tick(1000);
+  engine.tick(1500);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_HOLD));
+  engine.update(1600, START, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_FLICK));
+}
+
+void test_circles_count_eighths_of_a_turn(void)
+{
+  engine.add_rule(gesture_on(GESTURE_CIRCLE_CCW, 0, ACTION_CCW));
+  engine.add_rule(gesture_on(GESTURE_CIRCLE_CW, 0, ACTION_CW));
+
+  /** Counterclockwise from up, back to up: one full turn */
+  uint32_t t = 0;
+  for (int i = 0; i <= 8; i++, t += 50)
+    engine.update(t, 0, RIM_X[i % 8], RIM_Y[i % 8]);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_CCW));
+  TEST_ASSERT_EQUAL_INT(0, count_of(ACTION_CW));
+  engine.update(t, 0, 0, 0);
+
+  /** Clockwise, with jitter back across a sector boundary on the way */
+  t += 200;
+  engine.update(t, 0, RIM_X[0], RIM_Y[0]);
+  for (int i = 7; i >= 0; i--)
+  {
+    engine.update(t += 50, 0, RIM_X[i], RIM_Y[i]);
+    if (i == 4)
+    {
+      engine.update(t += 20, 0, RIM_X[5], RIM_Y[5]);
+      engine.update(t += 20, 0, RIM_X[4], RIM_Y[4]);
+    }
+  }
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_CW));
+  engine.update(t += 50, 0, 0, 0);
+
+  /** Seven eighths is not a circle */
+  t += 200;
+  for (int i = 0; i < 8; i++, t += 50)
+    engine.update(t, 0, RIM_X[i], RIM_Y[i]);
+  engine.update(t, 0, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_CCW));
+
+  /** Nor is a full turn slower than circle_ms */
+  t += 200;
+  for (int i = 0; i <= 8; i++, t += 250)
+    engine.update(t, 0, RIM_X[i % 8], RIM_Y[i % 8]);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_CCW));
+}
+
+void test_sequence_times_out_between_steps(void)
+{
+  const uint8_t symbols[] = {GESTURE_PRESS(0), GESTURE_PRESS(1), GESTURE_PRESS(2)};
+  engine.add_rule(gesture_sequence(symbols, 3, 300, ACTION_SEQUENCE));
+
+  /** Each step inside the timeout */
+  engine.update(0, 0x01, 0, 0);
+  engine.update(100, 0, 0, 0);
+  engine.update(200, 0x02, 0, 0);
+  engine.update(300, 0, 0, 0);
+  engine.update(450, 0x04, 0, 0);
+  engine.update(500, 0, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_SEQUENCE));
+
+  /** One gap too long, seen by the next report */
+  engine.update(1000, 0x01, 0, 0);
+  engine.update(1100, 0, 0, 0);
+  engine.update(1500, 0x02, 0, 0);
+  engine.update(1550, 0, 0, 0);
+  engine.update(1600, 0x04, 0, 0);
+  engine.update(1650, 0, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_SEQUENCE));
+
+  /** Or dropped by tick() while nothing arrives */
+  engine.update(2000, 0x01, 0, 0);
+  engine.update(2050, 0, 0, 0);
+  engine.tick(2400);
+  engine.update(2410, 0x02, 0, 0);
+  engine.update(2420, 0, 0, 0);
+  engine.update(2430, 0x04, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_SEQUENCE));
+
+  /** A stray press in between starts over */
+  engine.update(3000, 0, 0, 0);
+  engine.update(3010, 0x01, 0, 0);
+  engine.update(3020, 0, 0, 0);
+  engine.update(3030, 0x10, 0, 0);
+  engine.update(3040, 0, 0, 0);
+  engine.update(3050, 0x02, 0, 0);
+  engine.update(3060, 0, 0, 0);
+  engine.update(3070, 0x04, 0, 0);
+  TEST_ASSERT_EQUAL_INT(1, count_of(ACTION_SEQUENCE));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_chord_fires_once_when_pressed_in_one_report);
+  RUN_TEST(test_exact_chord_rejects_extra_buttons);
+  RUN_TEST(test_flick_and_hold_are_told_apart_by_time);
+  RUN_TEST(test_circles_count_eighths_of_a_turn);
+  RUN_TEST(test_sequence_times_out_between_steps);
+  return UNITY_END();
+}
@@ -0,0 +1,141 @@
+#include <unity.h>
+#include <string.h>
+#include <Hid_Feedback.h>
+
+// Hid_Feedback against a fake peripheral that logs every write: bursts
+// coalesce into the latest state and writes keep one connection interval
+// apart, whatever the caller queues.
+
+#define INTERVAL_US 15000
+#define MAX_WRITES 64
+
+typedef struct
+{
+  uint32_t t_us;
+  uint8_t kind;
+  uint8_t length;
+  uint8_t data[FEEDBACK_MAX_PAYLOAD];
+} write_t;
+
+static write_t writes[MAX_WRITES];
+static size_t write_count;
+static uint32_t now_us;
+static bool peer_accepts;
+
+static bool fake_write(uint8_t kind, const uint8_t *data, size_t length)
+{
+  if (write_count < MAX_WRITES)
+  {
+    write_t &w = writes[write_count++];
+    w.t_us = now_us;
+    w.kind = kind;
+    w.length = length;
+    memcpy(w.data, data, length);
+  }
+  return peer_accepts;
+}
+
+static Hid_Feedback feedback;
+
+void setUp(void)
+{
+  feedback = Hid_Feedback();
+  feedback.set_writer(fake_write);
+  feedback.set_interval_us(INTERVAL_US);
+  write_count = 0;
+  now_us = 1000000;
+  peer_accepts = true;
+}
+
+void tearDown(void) {}
+
+void test_burst_coalesces_to_latest(void)
+{
+  feedback.leds(1);
+  feedback.leds(2);
+  feedback.leds(4);
+  TEST_ASSERT_TRUE(feedback.pump(now_us));
+  now_us += INTERVAL_US;
+  TEST_ASSERT_FALSE(feedback.pump(now_us));
+
+  TEST_ASSERT_EQUAL_UINT32(1, write_count);
+  TEST_ASSERT_EQUAL_UINT8(FEEDBACK_LED, writes[0].kind);
+  TEST_ASSERT_EQUAL_UINT8(4, writes[0].data[0]);
+  TEST_ASSERT_EQUAL_UINT32(2, feedback.get_coalesced());
+}
+
+void test_one_write_per_interval(void)
+{
+  /** Queue something every millisecond, pump every 100us */
+  for (int ms = 0; ms < 200; ms++)
+  {
+    feedback.rumble(ms % 100, 100);
+    if (ms % 3 == 0)
+      feedback.leds(ms & 7);
+    for (int step = 0; step < 10; step++)
+    {
+      feedback.pump(now_us);
+      now_us += 100;
+    }
+  }
+  TEST_ASSERT_GREATER_THAN_UINT32(1, write_count);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(200000 / INTERVAL_US + 1, write_count);
+  for (size_t i = 1; i < write_count; i++)
+    TEST_ASSERT_GREATER_OR_EQUAL_UINT32(INTERVAL_US, writes[i].t_us - writes[i - 1].t_us);
+}
+
+void test_kinds_alternate(void)
+{
+  for (int i = 0; i < 4; i++)
+  {
+    feedback.rumble(50, 100);
+    feedback.leds(1);
+    feedback.pump(now_us);
+    now_us += INTERVAL_US;
+  }
+  for (size_t i = 1; i < write_count; i++)
+    TEST_ASSERT_NOT_EQUAL(writes[i - 1].kind, writes[i].kind);
+}
+
+void test_failed_write_still_paces(void)
+{
+  peer_accepts = false;
+  feedback.rumble(50, 100);
+  TEST_ASSERT_FALSE(feedback.pump(now_us));
+  feedback.rumble(60, 100);
+  TEST_ASSERT_FALSE(feedback.pump(now_us + INTERVAL_US - 1));
+  TEST_ASSERT_EQUAL_UINT32(1, write_count);
+  TEST_ASSERT_EQUAL_UINT32(1, feedback.get_failed());
+}
+
+void test_clear_drops_pending(void)
+{
+  feedback.rumble(50, 100);
+  feedback.leds(7);
+  feedback.clear();
+  TEST_ASSERT_FALSE(feedback.pump(now_us));
+  TEST_ASSERT_EQUAL_UINT32(0, write_count);
+}
+
+void test_rumble_report_layout(void)
+{
+  feedback.rumble(70, 5000);
+  feedback.pump(now_us);
+  TEST_ASSERT_EQUAL_UINT8(FEEDBACK_RUMBLE_SIZE, writes[0].length);
+  TEST_ASSERT_EQUAL_UINT8(0x03, writes[0].data[0]); /** both main motors */
+  TEST_ASSERT_EQUAL_UINT8(70, writes[0].data[3]);
+  TEST_ASSERT_EQUAL_UINT8(70, writes[0].data[4]);
+  TEST_ASSERT_EQUAL_UINT8(255, writes[0].data[5]);  /** duration saturates */
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_burst_coalesces_to_latest);
+  RUN_TEST(test_one_write_per_interval);
+  RUN_TEST(test_kinds_alternate);
+  RUN_TEST(test_failed_write_still_paces);
+  RUN_TEST(test_clear_drops_pending);
+  RUN_TEST(test_rumble_report_layout);
+  return UNITY_END();
+}
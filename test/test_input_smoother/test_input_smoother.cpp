@@ -0,0 +1,191 @@
+#include <unity.h>
+#include <stdlib.h>
+#include <Input_Smoother.h>
+
+// Host replay of stick report streams through Input_Smoother, sampled at the
+// firmware's 500 Hz control rate. The raw path is what the motors saw before
+// smoothing: the newest report, applied when it arrives.
+
+#define CONTROL_PERIOD_US 2000
+#define RENDER_DELAY_US 15000
+#define MAX_EXTRAPOLATION_US 20000
+
+typedef struct
+{
+  uint32_t t_us;
+  int y;
+} report_t;
+
+// Forward and back on a 15 ms connection interval as a gamepad reports it:
+// only on change, notifications bunched on connection events with a few
+// hundred us of jitter, one event missed at 142 ms.
+static const report_t PUSH_AND_RELEASE[] = {
+    {10120, 0},     {25080, 37},    {40210, 91},    {55150, 148},
+    {70090, 203},   {85230, 241},   {100110, 255},  {142280, 251},
+    {157150, 255},  {262040, 214},  {277190, 150},  {292100, 83},
+    {307230, 21},   {322150, 0},
+};
+
+// The reverse kick from review: full reverse, released in two reports.
+static const report_t REVERSE_RELEASE[] = {
+    {0, -255}, {15000, -255}, {30000, -128}, {45000, 0},
+};
+
+// Half forward and held, the stick stops moving between reports.
+static const report_t PUSH_AND_HOLD[] = {
+    {0, 0}, {15000, 60}, {30000, 120}, {45000, 128},
+};
+
+// Pushed and held on a large step, the stick stops right after it.
+static const report_t PUSH_AND_HOLD_LARGE[] = {
+    {0, 0}, {15000, 60}, {30000, 120},
+};
+
+// Single steps out of rest, as a Hid_Drive_Map keypress sends them.
+static const report_t KEY_STEP[] = {
+    {0, 160},
+};
+static const report_t STEP_AFTER_PAUSE[] = {
+    {0, 0}, {50000, 200},
+};
+
+#define REPLAY_SAMPLES 256
+
+typedef struct
+{
+  int raw[REPLAY_SAMPLES];
+  int smooth[REPLAY_SAMPLES];
+  size_t count;
+} replay_t;
+
+static void replay(const report_t *reports, size_t n, replay_t &out)
+{
+  Input_Smoother smoother(RENDER_DELAY_US, MAX_EXTRAPOLATION_US);
+  size_t next = 0;
+  int raw = 0;
+  out.count = 0;
+  for (uint32_t t = 0; out.count < REPLAY_SAMPLES; t += CONTROL_PERIOD_US)
+  {
+    while (next < n && reports[next].t_us <= t)
+    {
+      smoother.push(reports[next].t_us, 0, reports[next].y);
+      raw = reports[next].y;
+      next++;
+    }
+    int x, y;
+    smoother.sample(t, x, y);
+    out.raw[out.count] = raw;
+    out.smooth[out.count] = y;
+    out.count++;
+  }
+}
+
+/** Sum of |second difference|, the jerk the motors see per control period */
+static long jerk(const int *v, size_t n)
+{
+  long sum = 0;
+  for (size_t i = 2; i < n; i++)
+    sum += labs((long)v[i] - 2 * v[i - 1] + v[i - 2]);
+  return sum;
+}
+
+/** First sample index at or after from where v crosses level in the given direction */
+static size_t crossing(const int *v, size_t n, size_t from, int level, bool rising)
+{
+  for (size_t i = from; i < n; i++)
+  {
+    if (rising ? v[i] >= level : v[i] <= level)
+      return i;
+  }
+  return n;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_smoothing_cuts_jerk(void)
+{
+  replay_t r;
+  replay(PUSH_AND_RELEASE, sizeof(PUSH_AND_RELEASE) / sizeof(report_t), r);
+  long raw = jerk(r.raw, r.count);
+  long smooth = jerk(r.smooth, r.count);
+  char msg[64];
+  snprintf(msg, sizeof(msg), "raw jerk %ld, smoothed %ld", raw, smooth);
+  TEST_MESSAGE(msg);
+  /** At least 4x smoother than stepping at the connection interval */
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(raw / 4, smooth, msg);
+}
+
+void test_added_latency_is_bounded(void)
+{
+  replay_t r;
+  replay(PUSH_AND_RELEASE, sizeof(PUSH_AND_RELEASE) / sizeof(report_t), r);
+  /** Half way up and half way back down, against the raw stream */
+  size_t raw_up = crossing(r.raw, r.count, 0, 128, true);
+  size_t smooth_up = crossing(r.smooth, r.count, 0, 128, true);
+  size_t raw_down = crossing(r.raw, r.count, raw_up + 50, 128, false);
+  size_t smooth_down = crossing(r.smooth, r.count, smooth_up + 50, 128, false);
+  TEST_ASSERT_LESS_THAN(r.count, smooth_down);
+
+  uint32_t lag_up = (smooth_up - raw_up) * CONTROL_PERIOD_US;
+  uint32_t lag_down = (smooth_down - raw_down) * CONTROL_PERIOD_US;
+  char msg[64];
+  snprintf(msg, sizeof(msg), "added latency up %u us, down %u us", (unsigned)lag_up, (unsigned)lag_down);
+  TEST_MESSAGE(msg);
+  /** The render delay plus one control period, nothing on top */
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32_MESSAGE(RENDER_DELAY_US + CONTROL_PERIOD_US, lag_up, msg);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32_MESSAGE(RENDER_DELAY_US + CONTROL_PERIOD_US, lag_down, msg);
+}
+
+void test_release_never_reverses(void)
+{
+  replay_t r;
+  replay(REVERSE_RELEASE, sizeof(REVERSE_RELEASE) / sizeof(report_t), r);
+  for (size_t i = 0; i < r.count; i++)
+    TEST_ASSERT_LESS_OR_EQUAL(0, r.smooth[i]);
+  TEST_ASSERT_EQUAL_INT(0, r.smooth[r.count - 1]);
+
+  replay(PUSH_AND_RELEASE, sizeof(PUSH_AND_RELEASE) / sizeof(report_t), r);
+  for (size_t i = 0; i < r.count; i++)
+    TEST_ASSERT_GREATER_OR_EQUAL(0, r.smooth[i]);
+  TEST_ASSERT_EQUAL_INT(0, r.smooth[r.count - 1]);
+}
+
+/** Highest output, which must stay close to the held value and settle on it */
+static void check_hold(const report_t *reports, size_t n)
+{
+  replay_t r;
+  replay(reports, n, r);
+  int held = reports[n - 1].y;
+  int peak = held;
+  for (size_t i = 0; i < r.count; i++)
+    peak = r.smooth[i] > peak ? r.smooth[i] : peak;
+  char msg[48];
+  snprintf(msg, sizeof(msg), "held %d, peak %d", held, peak);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(held + INPUT_SMOOTHER_MAX_OVERSHOOT, peak, msg);
+  TEST_ASSERT_EQUAL_INT(held, r.smooth[r.count - 1]);
+}
+
+void test_stale_input_never_overshoots(void)
+{
+  replay_t r;
+  replay(PUSH_AND_RELEASE, sizeof(PUSH_AND_RELEASE) / sizeof(report_t), r);
+  for (size_t i = 0; i < r.count; i++)
+    TEST_ASSERT_LESS_OR_EQUAL(INPUT_SMOOTHER_FULL_SCALE, r.smooth[i]);
+
+  check_hold(PUSH_AND_HOLD, sizeof(PUSH_AND_HOLD) / sizeof(report_t));
+  check_hold(PUSH_AND_HOLD_LARGE, sizeof(PUSH_AND_HOLD_LARGE) / sizeof(report_t));
+  check_hold(KEY_STEP, sizeof(KEY_STEP) / sizeof(report_t));
+  check_hold(STEP_AFTER_PAUSE, sizeof(STEP_AFTER_PAUSE) / sizeof(report_t));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_smoothing_cuts_jerk);
+  RUN_TEST(test_added_latency_is_bounded);
+  RUN_TEST(test_release_never_reverses);
+  RUN_TEST(test_stale_input_never_overshoots);
+  return UNITY_END();
+}
@@ -0,0 +1,263 @@
+#include <unity.h>
+#include <stdio.h>
+#include <chrono>
+#include <Macro_Codec.h>
+
+// The Drive_Macro recorder and reader on the host, fed with a stick stream
+// shaped like a recorded take: reports every 7.5-30ms, the setpoint
+// wandering across the full -255..255 range. Covers the round trip, the
+// frame size, the full buffer, and the playback timing a player scheduling
+// against the reader's offsets gets.
+
+#define TAKE_FRAMES 4000
+#define BUFFER_SIZE 4096            /** MACRO_BUFFER_SIZE in Drive_Macro.h */
+#define MAX_AVG_FRAME_BYTES 5       /** the "4-5 bytes" the recorder promises */
+#define MAX_NS_PER_FRAME 200        /** record plus read back, host */
+#define TIMING_ROUNDS 200
+#define TIMER_LATENCY_US 500        /** worst esp_timer dispatch latency modelled */
+#define START_US 0xFFFF0000u        /** close to the micros() wrap */
+
+static uint32_t rng_state;
+
+static uint32_t rng()
+{
+  rng_state = rng_state * 1664525u + 1013904223u;
+  return rng_state >> 8;
+}
+
+static int clamp_axis(int v)
+{
+  return v > 255 ? 255 : v < -255 ? -255 : v;
+}
+
+/** Report arrival stamps and setpoints of a synthetic take */
+static uint32_t take_t[TAKE_FRAMES];
+static int take_x[TAKE_FRAMES], take_y[TAKE_FRAMES];
+
+static void make_take()
+{
+  rng_state = 2024;
+  uint32_t t = START_US;
+  int x = 0, y = 0;
+  for (int i = 0; i < TAKE_FRAMES; i++)
+  {
+    t += 7500 + rng() % 22500;
+    /** Change at least one axis, like a pad that reports on change */
+    int dx = (int)(rng() % 41) - 20;
+    int dy = (int)(rng() % 41) - 20;
+    x = clamp_axis(x + (dx ? dx : 1));
+    y = clamp_axis(y + dy);
+    take_t[i] = t;
+    take_x[i] = x;
+    take_y[i] = y;
+  }
+}
+
+static uint8_t buffer[BUFFER_SIZE];
+
+/** Records the take, returns the reports that made it in before it filled */
+static int record_take(Macro_Recorder &recorder, uint32_t stop_us)
+{
+  recorder.start(START_US);
+  int i = 0;
+  for (; i < TAKE_FRAMES && recorder.record(take_t[i], take_x[i], take_y[i]); i++)
+    ;
+  if (recorder.is_recording())
+    recorder.stop(stop_us);
+  return i;
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_varint_and_zigzag_round_trip(void)
+{
+  const uint32_t values[] = {0, 1, 127, 128, 16383, 16384, 0x0FFFFFFF, 0xFFFFFFFF};
+  for (uint32_t v : values)
+  {
+    uint8_t out[5];
+    uint32_t back;
+    size_t n = put_varint(out, v);
+    TEST_ASSERT_EQUAL_UINT32(n, get_varint(out, n, back));
+    TEST_ASSERT_EQUAL_UINT32(v, back);
+    /** One byte short is truncated, not misread */
+    TEST_ASSERT_EQUAL_UINT32(0, get_varint(out, n - 1, back));
+  }
+  const int32_t deltas[] = {0, 1, -1, 63, -64, 510, -510};
+  for (int32_t d : deltas)
+    TEST_ASSERT_EQUAL_INT(d, unzigzag(zigzag(d)));
+}
+
+void test_take_round_trip(void)
+{
+  Macro_Recorder recorder(buffer, sizeof(buffer));
+  int recorded = record_take(recorder, 0);
+  TEST_ASSERT_TRUE(recorder.is_full());
+
+  Macro_Reader reader;
+  reader.reset(buffer, recorder.get_length());
+  uint32_t at_us;
+  int x, y;
+  bool changed;
+  for (int i = 0; i < recorded; i++)
+  {
+    TEST_ASSERT_TRUE(reader.next(at_us, x, y, changed));
+    TEST_ASSERT_TRUE(changed);
+    /** Exact: the frame plays at the offset its report arrived at */
+    TEST_ASSERT_EQUAL_UINT32(take_t[i] - START_US, at_us);
+    TEST_ASSERT_EQUAL_INT(take_x[i], x);
+    TEST_ASSERT_EQUAL_INT(take_y[i], y);
+  }
+}
+
+void test_full_buffer_closes_the_take(void)
+{
+  Macro_Recorder recorder(buffer, sizeof(buffer));
+  int recorded = record_take(recorder, 0);
+  TEST_ASSERT_LESS_THAN(TAKE_FRAMES, recorded);
+  TEST_ASSERT_FALSE(recorder.is_recording());
+  TEST_ASSERT_TRUE(recorder.is_full());
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(BUFFER_SIZE, recorder.get_length());
+
+  /** The closing frame holds the last recorded setpoint until the report that did not fit */
+  Macro_Reader reader;
+  reader.reset(buffer, recorder.get_length());
+  uint32_t at_us, last_at = 0;
+  int x, y, last_x = 0, last_y = 0;
+  bool changed, last_changed = true;
+  uint16_t frames = 0;
+  while (reader.next(at_us, x, y, changed))
+  {
+    last_at = at_us;
+    last_x = x;
+    last_y = y;
+    last_changed = changed;
+    frames++;
+  }
+  TEST_ASSERT_EQUAL_UINT32(recorder.get_frames(), frames);
+  TEST_ASSERT_FALSE(last_changed);
+  TEST_ASSERT_EQUAL_UINT32(take_t[recorded] - START_US, last_at);
+  TEST_ASSERT_EQUAL_UINT32(recorder.get_duration_us(), last_at);
+  TEST_ASSERT_EQUAL_INT(take_x[recorded - 1], last_x);
+  TEST_ASSERT_EQUAL_INT(take_y[recorded - 1], last_y);
+
+  /** The record chord only acknowledges it, the take survives */
+  size_t length = recorder.get_length();
+  recorder.stop(take_t[recorded] + 100000);
+  TEST_ASSERT_FALSE(recorder.is_full());
+  TEST_ASSERT_EQUAL_UINT32(length, recorder.get_length());
+}
+
+void test_input_older_than_start_plays_at_once(void)
+{
+  /** The chord is handled after the report that carried it arrived */
+  Macro_Recorder recorder(buffer, sizeof(buffer));
+  recorder.start(10000);
+  TEST_ASSERT_TRUE(recorder.record(9000, 1, 0));
+  TEST_ASSERT_TRUE(recorder.record(25000, 40, 0));
+  recorder.stop(40000);
+
+  Macro_Reader reader;
+  reader.reset(buffer, recorder.get_length());
+  uint32_t at_us;
+  int x, y;
+  bool changed;
+  TEST_ASSERT_TRUE(reader.next(at_us, x, y, changed));
+  TEST_ASSERT_EQUAL_UINT32(0, at_us);
+  TEST_ASSERT_TRUE(reader.next(at_us, x, y, changed));
+  TEST_ASSERT_EQUAL_UINT32(15000, at_us);
+  TEST_ASSERT_EQUAL_UINT32(30000, recorder.get_duration_us());
+}
+
+void test_restore_matches_the_recording(void)
+{
+  Macro_Recorder recorder(buffer, sizeof(buffer));
+  record_take(recorder, 0);
+  Macro_Recorder loaded(buffer, sizeof(buffer));
+  TEST_ASSERT_TRUE(loaded.restore(recorder.get_length()));
+  TEST_ASSERT_EQUAL_UINT32(recorder.get_frames(), loaded.get_frames());
+  TEST_ASSERT_EQUAL_UINT32(recorder.get_duration_us(), loaded.get_duration_us());
+  TEST_ASSERT_FALSE(loaded.restore(0));
+}
+
+void test_playback_timing_does_not_drift(void)
+{
+  /** Drive_Macro's rule: every frame due at start + offset, the timer
+   *  firing up to TIMER_LATENCY_US late and the next deadline armed after it */
+  Macro_Recorder recorder(buffer, sizeof(buffer));
+  int recorded = record_take(recorder, 0);
+  Macro_Reader reader;
+  reader.reset(buffer, recorder.get_length());
+  int64_t start = 5000000, now = start;
+  uint32_t at_us, max_error = 0;
+  int x, y;
+  bool changed;
+  for (int i = 0; i < recorded && reader.next(at_us, x, y, changed); i++)
+  {
+    int64_t due = start + at_us;
+    now = (due > now ? due : now) + rng() % (TIMER_LATENCY_US + 1);
+    int32_t error = (int32_t)(now - (start + (int64_t)(take_t[i] - START_US)));
+    TEST_ASSERT_GREATER_OR_EQUAL_INT32(0, error);
+    if ((uint32_t)error > max_error)
+      max_error = error;
+  }
+  char msg[48];
+  snprintf(msg, sizeof(msg), "max %lu us late", (unsigned long)max_error);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32_MESSAGE(TIMER_LATENCY_US, max_error, msg);
+}
+
+void test_frame_size(void)
+{
+  Macro_Recorder recorder(buffer, sizeof(buffer));
+  record_take(recorder, 0);
+  char msg[64];
+  snprintf(msg, sizeof(msg), "%u frames in %u bytes", recorder.get_frames(), (unsigned)recorder.get_length());
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32_MESSAGE(MAX_AVG_FRAME_BYTES * recorder.get_frames(), recorder.get_length(), msg);
+
+  /** The worst case still fits the recorder's reservation */
+  uint8_t out[MACRO_MAX_FRAME_SIZE];
+  macro_frame_t worst = {MACRO_MAX_DT_US, MACRO_AXIS_X | MACRO_AXIS_Y, -510, 510};
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(MACRO_MAX_FRAME_SIZE, macro_put_frame(out, worst));
+}
+
+void test_frame_timing(void)
+{
+  static uint8_t big[TAKE_FRAMES * MACRO_MAX_FRAME_SIZE];
+  Macro_Recorder recorder(big, sizeof(big));
+  Macro_Reader reader;
+  volatile int32_t sink = 0;
+  auto start = std::chrono::steady_clock::now();
+  for (int round = 0; round < TIMING_ROUNDS; round++)
+  {
+    record_take(recorder, take_t[TAKE_FRAMES - 1]);
+    reader.reset(big, recorder.get_length());
+    uint32_t at_us;
+    int x, y;
+    bool changed;
+    while (reader.next(at_us, x, y, changed))
+      sink = sink + x;
+  }
+  auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  uint32_t per_frame = (uint32_t)(ns / ((int64_t)TIMING_ROUNDS * TAKE_FRAMES));
+  char msg[48];
+  snprintf(msg, sizeof(msg), "%lu ns per frame", (unsigned long)per_frame);
+  TEST_MESSAGE(msg);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32_MESSAGE(MAX_NS_PER_FRAME, per_frame, msg);
+}
+
+int main(int argc, char **argv)
+{
+  make_take();
+  UNITY_BEGIN();
+  RUN_TEST(test_varint_and_zigzag_round_trip);
+  RUN_TEST(test_take_round_trip);
+  RUN_TEST(test_full_buffer_closes_the_take);
+  RUN_TEST(test_input_older_than_start_plays_at_once);
+  RUN_TEST(test_restore_matches_the_recording);
+  RUN_TEST(test_playback_timing_does_not_drift);
+  RUN_TEST(test_frame_size);
+  RUN_TEST(test_frame_timing);
+  return UNITY_END();
+}
@@ -0,0 +1,150 @@
+#include <unity.h>
+#include <stdio.h>
+#include <Pipeline_Bench.h>
+
+// The hot path benchmark as a test: the JSON lines are printed as before and
+// every figure is held against a threshold, so a slower hot path fails.
+//   pio test -e native -f test_pipeline_bench
+//   pio test -e seeed_xiao_esp32c3 -f test_pipeline_bench
+// On target it writes real duty cycles to the default motor pins, lift the
+// wheels first. Thresholds are per operation, in CPU cycles on target and in
+// nanoseconds natively, a few times above what the hot path costs today.
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+#define MOT_B2_PIN D3
+#define MOT_B1_PIN D4
+#define MOT_A2_PIN D5
+#define MOT_A1_PIN D6
+
+#define MAX_DECODE_REPORT 400
+#define MAX_DECODE_AXIS 200
+#define MAX_GESTURES 3000
+#define MAX_BUTTON_EDGES 1000
+#define MAX_SMOOTHER 3000
+#define MAX_MIX 200
+#define MAX_PWM_WRITE 40000
+#else
+#define MAX_DECODE_REPORT 200
+#define MAX_DECODE_AXIS 100
+#define MAX_GESTURES 1000
+#define MAX_BUTTON_EDGES 500
+#define MAX_SMOOTHER 1000
+#define MAX_MIX 100
+#define MAX_PWM_WRITE 100
+#endif
+/** Share of the 1 kHz report period, in hundredths of a percent */
+#define MAX_LOAD_X100 1000
+
+static bench_results_t results;
+static bool done = false;
+
+static void print_line(const char *line)
+{
+  TEST_MESSAGE(line);
+}
+
+#ifdef ARDUINO
+static void set_motor_pwm(int pwm, int in1, int in2)
+{
+  analogWrite(in1, pwm < 0 ? -pwm : 0);
+  analogWrite(in2, pwm < 0 ? 0 : pwm);
+}
+
+static void motor_pwm(int left, int right)
+{
+  set_motor_pwm(left, MOT_A1_PIN, MOT_A2_PIN);
+  set_motor_pwm(right, MOT_B1_PIN, MOT_B2_PIN);
+}
+#endif
+
+/** Runs the suite once, the tests below check its results */
+static const bench_results_t &bench()
+{
+  if (!done)
+  {
+#ifdef ARDUINO
+    bench_config_t config = {16, 1000, 500, motor_pwm};
+#else
+    bench_config_t config = {16, 1000, 500, nullptr};
+#endif
+    run_pipeline_bench(config, print_line, &results);
+    done = true;
+  }
+  return results;
+}
+
+/** Fastest round, per operation, against a limit in whole units */
+static void check(const char *name, const bench_micro_t &m, uint32_t limit)
+{
+  char msg[96];
+  snprintf(msg, sizeof(msg), "%s: %lu.%02lu per op, limit %lu", name,
+           (unsigned long)m.min / 100, (unsigned long)m.min % 100, (unsigned long)limit);
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32_MESSAGE(limit * 100, m.min, msg);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_decode(void)
+{
+  check("decode_report", bench().decode_report, MAX_DECODE_REPORT);
+  check("decode_axis", bench().decode_axis, MAX_DECODE_AXIS);
+}
+
+void test_gestures_and_edges(void)
+{
+  check("gestures", bench().gestures, MAX_GESTURES);
+  check("button_edges", bench().button_edges, MAX_BUTTON_EDGES);
+}
+
+void test_smoother_mix_pwm(void)
+{
+  check("smoother", bench().smoother, MAX_SMOOTHER);
+  check("mix", bench().mix, MAX_MIX);
+  check("pwm_write", bench().pwm_write, MAX_PWM_WRITE);
+}
+
+void test_pipeline_keeps_up(void)
+{
+  for (int i = 0; i < BENCH_RATES; i++)
+  {
+    const bench_pipeline_t &p = bench().pipeline[i];
+    char msg[64];
+    snprintf(msg, sizeof(msg), "%lu Hz missed %lu slots", (unsigned long)p.rate_hz, (unsigned long)p.missed);
+    TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, p.missed, msg);
+  }
+  const bench_pipeline_t &fastest = bench().pipeline[BENCH_RATES - 1];
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32_MESSAGE(MAX_LOAD_X100, fastest.load_x100, "load at 1 kHz");
+}
+
+static void run_tests()
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_decode);
+  RUN_TEST(test_gestures_and_edges);
+  RUN_TEST(test_smoother_mix_pwm);
+  RUN_TEST(test_pipeline_keeps_up);
+  UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+  delay(2000); /** give the test runner time to attach */
+  pinMode(MOT_A1_PIN, OUTPUT);
+  pinMode(MOT_A2_PIN, OUTPUT);
+  pinMode(MOT_B1_PIN, OUTPUT);
+  pinMode(MOT_B2_PIN, OUTPUT);
+  run_tests();
+}
+
+void loop() {}
+#else
+int main(int argc, char **argv)
+{
+  run_tests();
+  return 0;
+}
+#endif
@@ -0,0 +1,210 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Relay_Frame.h>
+
+// Host simulation of the relay fan-out: one sender rebroadcasting gamepad
+// reports to a fleet, with the real frame format and receiver filter and a
+// simple radio model. Latency is report arrival at the sender to the frame
+// being accepted by a receiver, compared against sending one unicast frame
+// per robot.
+
+#define REPORTS 2000
+#define REPORT_INTERVAL_US 15000
+#define SEND_OVERHEAD_US 60     /** decode, frame build, esp_now_send() */
+#define AIRTIME_US 600          /** ~52 byte 1 Mbps broadcast including preamble */
+#define BACKOFF_SLOTS 16        /** contention window */
+#define SLOT_US 9
+#define ACK_US 100              /** SIFS + ACK, unicast only */
+#define RECEIVE_US 40           /** WiFi task to frame callback */
+#define LOSS_PERMILLE 20
+#define DUPLICATE_PERMILLE 10
+#define RELAY_TIMEOUT_MS 500    /** receiver failsafe in main.cpp */
+#define MAX_ROBOTS 8
+
+static uint32_t rng_state;
+
+static uint32_t rng()
+{
+  rng_state = rng_state * 1664525u + 1013904223u;
+  return rng_state >> 8;
+}
+
+typedef struct
+{
+  uint32_t p50, p99, max;
+  uint32_t accepted, lost, dropped;
+  uint32_t longest_gap_ms;
+} fanout_result_t;
+
+static int compare_u32(const void *a, const void *b)
+{
+  uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+  return x < y ? -1 : x > y;
+}
+
+static uint32_t latencies[REPORTS * MAX_ROBOTS];
+
+/** outage_robot loses everything between outage_from and outage_to (us) */
+static fanout_result_t simulate(int robots, bool broadcast, int outage_robot = -1,
+                                uint32_t outage_from = 0, uint32_t outage_to = 0)
+{
+  rng_state = 12345;
+  Relay_Filter filters[MAX_ROBOTS];
+  uint32_t last_accept_ms[MAX_ROBOTS] = {};
+  fanout_result_t result = {};
+  size_t n = 0;
+  uint32_t radio_free = 0;
+  /** Unicast numbers each robot's stream on its own */
+  uint16_t seq[MAX_ROBOTS] = {};
+
+  for (int r = 0; r < robots; r++)
+    filters[r].set_address(r + 1);
+
+  for (int i = 0; i < REPORTS; i++)
+  {
+    uint32_t arrival = 10000 + i * REPORT_INTERVAL_US + rng() % 500;
+    uint32_t ready = arrival + SEND_OVERHEAD_US;
+    int frames = broadcast ? 1 : robots;
+    for (int f = 0; f < frames; f++)
+    {
+      drive_frame_t frame;
+      make_frame(frame, broadcast ? RELAY_ALL : f + 1, ++seq[f], 0, 255, 0);
+      uint32_t start = ready > radio_free ? ready : radio_free;
+      start += (rng() % BACKOFF_SLOTS) * SLOT_US;
+      uint32_t end = start + AIRTIME_US + (broadcast ? 0 : ACK_US);
+      radio_free = end;
+      ready = end;
+
+      for (int r = 0; r < robots; r++)
+      {
+        if (!broadcast && r != f)
+          continue;
+        uint32_t rx = end + RECEIVE_US;
+        bool out = r == outage_robot && rx >= outage_from && rx < outage_to;
+        if (out || rng() % 1000 < LOSS_PERMILLE)
+          continue;
+        int copies = rng() % 1000 < DUPLICATE_PERMILLE ? 2 : 1;
+        for (int c = 0; c < copies; c++)
+        {
+          drive_frame_t got;
+          if (!filters[r].accept((const uint8_t *)&frame, sizeof(frame), rx / 1000, got))
+          {
+            result.dropped++;
+            continue;
+          }
+          uint32_t gap = rx / 1000 - last_accept_ms[r];
+          if (last_accept_ms[r] && gap > result.longest_gap_ms)
+            result.longest_gap_ms = gap;
+          last_accept_ms[r] = rx / 1000;
+          latencies[n++] = rx - arrival;
+        }
+      }
+    }
+  }
+
+  for (int r = 0; r < robots; r++)
+  {
+    result.accepted += filters[r].get_received();
+    result.lost += filters[r].get_lost();
+  }
+  qsort(latencies, n, sizeof(uint32_t), compare_u32);
+  result.p50 = latencies[n / 2];
+  result.p99 = latencies[n * 99 / 100];
+  result.max = latencies[n - 1];
+  return result;
+}
+
+static void report(const char *mode, int robots, const fanout_result_t &r)
+{
+  char line[160];
+  snprintf(line, sizeof(line),
+           "{\"fanout\":\"%s\",\"robots\":%d,\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u,\"lost\":%u}",
+           mode, robots, (unsigned)r.p50, (unsigned)r.p99, (unsigned)r.max, (unsigned)r.lost);
+  TEST_MESSAGE(line);
+}
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_broadcast_latency_does_not_grow_with_fleet(void)
+{
+  fanout_result_t one = simulate(1, true);
+  report("broadcast", 1, one);
+  for (int robots = 2; robots <= MAX_ROBOTS; robots *= 2)
+  {
+    fanout_result_t r = simulate(robots, true);
+    report("broadcast", robots, r);
+    /** Same radio time per report however many robots listen */
+    TEST_ASSERT_INT_WITHIN(SLOT_US * BACKOFF_SLOTS, one.p99, r.p99);
+  }
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(1000, one.p99);
+}
+
+void test_broadcast_beats_unicast(void)
+{
+  for (int robots = 1; robots <= MAX_ROBOTS; robots *= 2)
+    report("unicast", robots, simulate(robots, false));
+  fanout_result_t b = simulate(MAX_ROBOTS, true);
+  fanout_result_t u = simulate(MAX_ROBOTS, false);
+  /** The last robot of a unicast round waits for all the others */
+  TEST_ASSERT_GREATER_THAN(3 * b.p99, u.p99);
+}
+
+void test_sequence_accounts_for_every_frame(void)
+{
+  fanout_result_t r = simulate(MAX_ROBOTS, true);
+  /** Duplicates dropped, every frame either accepted or counted lost. Only
+   *  losses before the first or after the last accepted frame go unseen.
+   */
+  TEST_ASSERT_GREATER_THAN(0, r.dropped);
+  TEST_ASSERT_INT_WITHIN(MAX_ROBOTS * 3, (uint32_t)REPORTS * MAX_ROBOTS, r.accepted + r.lost);
+  TEST_ASSERT_INT_WITHIN(REPORTS * MAX_ROBOTS * LOSS_PERMILLE / 1000 / 3,
+                         REPORTS * MAX_ROBOTS * LOSS_PERMILLE / 1000, r.lost);
+}
+
+void test_staleness_rule(void)
+{
+  /** Random loss alone never trips the failsafe... */
+  fanout_result_t r = simulate(MAX_ROBOTS, true);
+  TEST_ASSERT_LESS_THAN(RELAY_TIMEOUT_MS, r.longest_gap_ms);
+  /** ...an outage does, and the receiver picks the stream up after it */
+  fanout_result_t o = simulate(MAX_ROBOTS, true, 3, 5000000, 5600000);
+  TEST_ASSERT_GREATER_THAN(RELAY_TIMEOUT_MS, o.longest_gap_ms);
+  TEST_ASSERT_GREATER_THAN(r.lost, o.lost);
+}
+
+void test_filter_rules(void)
+{
+  Relay_Filter filter;
+  filter.set_address(2);
+  drive_frame_t frame, got;
+
+  make_frame(frame, 3, 1, 10, 20, 0);
+  TEST_ASSERT_FALSE(filter.accept((const uint8_t *)&frame, sizeof(frame), 0, got));
+  make_frame(frame, 2, 1, 10, 20, 0);
+  TEST_ASSERT_TRUE(filter.accept((const uint8_t *)&frame, sizeof(frame), 0, got));
+  TEST_ASSERT_EQUAL_INT(20, got.y);
+  TEST_ASSERT_FALSE(filter.accept((const uint8_t *)&frame, sizeof(frame), 10, got));
+  make_frame(frame, RELAY_ALL, 5, 0, 0, RELAY_FLAG_STOP);
+  TEST_ASSERT_TRUE(filter.accept((const uint8_t *)&frame, sizeof(frame), 20, got));
+  TEST_ASSERT_EQUAL_UINT32(3, filter.get_lost());
+  /** Late frame dropped, a restarted sender is accepted after the resync time */
+  make_frame(frame, 2, 4, 0, 0, 0);
+  TEST_ASSERT_FALSE(filter.accept((const uint8_t *)&frame, sizeof(frame), 30, got));
+  make_frame(frame, 2, 1, 0, 0, 0);
+  TEST_ASSERT_TRUE(filter.accept((const uint8_t *)&frame, sizeof(frame), 30 + RELAY_RESYNC_MS + 1, got));
+  TEST_ASSERT_FALSE(filter.accept((const uint8_t *)&frame, sizeof(frame) - 1, 2000, got));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_broadcast_latency_does_not_grow_with_fleet);
+  RUN_TEST(test_broadcast_beats_unicast);
+  RUN_TEST(test_sequence_accounts_for_every_frame);
+  RUN_TEST(test_staleness_rule);
+  RUN_TEST(test_filter_rules);
+  return UNITY_END();
+}
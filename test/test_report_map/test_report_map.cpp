@@ -0,0 +1,92 @@
+#include <unity.h>
+#include <Joystick_Decode.h>
+
+// Report Map parsing the client relies on when it connects: a pad that also
+// declares a keyboard must stay a gamepad, and rumble only goes to an
+// output report the map declares as force feedback of the right size.
+
+/** Generic Desktop Keyboard, the HID spec's boot keyboard example, trimmed */
+static const uint8_t KEYBOARD_MAP[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01,             // Usage Page (GD), Usage (Keyboard), Application
+    0x05, 0x07, 0x19, 0xE0, 0x29, 0xE7, 0x15, 0x00, // Key codes, modifiers
+    0x25, 0x01, 0x75, 0x01, 0x95, 0x08, 0x81, 0x02, // Input (Data, Var, Abs)
+    0xC0};
+
+/** Mouse with a nested Physical collection whose Pointer usage is not an application */
+static const uint8_t MOUSE_MAP[] = {
+    0x05, 0x01, 0x09, 0x02, 0xA1, 0x01, // Mouse, Application
+    0x09, 0x01, 0xA1, 0x00,             // Pointer, Physical
+    0x09, 0x30, 0x09, 0x31, 0x15, 0x81, 0x25, 0x7F,
+    0x75, 0x08, 0x95, 0x02, 0x81, 0x06,
+    0xC0, 0xC0};
+
+/** Gamepad with a consumer keyboard and a 4 byte usage, as combo pads ship */
+static const uint8_t COMBO_MAP[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01, 0xC0, // Keyboard, report 1
+    0x0B, 0x05, 0x00, 0x01, 0x00, 0xA1, 0x01,             // Usage (GD:Gamepad) in 4 bytes
+    0x85, 0x03, 0x09, 0x30, 0x09, 0x31, 0x15, 0x00, 0x26, 0xFF, 0x00,
+    0x75, 0x08, 0x95, 0x02, 0x81, 0x02,
+    0xC0};
+
+/** Xbox style rumble (report 3, PID page, 8 bytes) next to keyboard LEDs (report 1) */
+static const uint8_t OUTPUT_MAP[] = {
+    0x05, 0x01, 0x09, 0x06, 0xA1, 0x01, 0x85, 0x01,             // Keyboard, report 1
+    0x05, 0x08, 0x19, 0x01, 0x29, 0x05, 0x75, 0x01, 0x95, 0x05, // LED page, 5 x 1 bit
+    0x91, 0x02, 0x75, 0x03, 0x95, 0x01, 0x91, 0x03, 0xC0,       // Output, 3 bit padding
+    0x05, 0x01, 0x09, 0x05, 0xA1, 0x01, 0x85, 0x03,             // Gamepad, report 3
+    0x05, 0x0F, 0x09, 0x21, 0xA1, 0x02,                         // PID page, Set Effect Report
+    0x09, 0x97, 0x15, 0x00, 0x25, 0x01, 0x75, 0x04, 0x95, 0x01, 0x91, 0x02, // enable actuators
+    0x75, 0x04, 0x95, 0x01, 0x91, 0x03,                         // padding
+    0x09, 0x70, 0x25, 0x64, 0x75, 0x08, 0x95, 0x04, 0x91, 0x02, // 4 magnitudes
+    0x09, 0x50, 0x26, 0xFF, 0x00, 0x95, 0x03, 0x91, 0x02,       // duration, delay, loops
+    0xC0, 0xC0};
+
+void setUp(void) {}
+void tearDown(void) {}
+
+void test_keyboard(void)
+{
+  TEST_ASSERT_EQUAL_HEX8(HID_APP_KEYBOARD, report_map_applications(KEYBOARD_MAP, sizeof(KEYBOARD_MAP)));
+}
+
+void test_mouse_ignores_nested_collections(void)
+{
+  TEST_ASSERT_EQUAL_HEX8(HID_APP_MOUSE, report_map_applications(MOUSE_MAP, sizeof(MOUSE_MAP)));
+}
+
+void test_combo_pad_declares_gamepad(void)
+{
+  TEST_ASSERT_EQUAL_HEX8(HID_APP_KEYBOARD | HID_APP_GAMEPAD,
+                         report_map_applications(COMBO_MAP, sizeof(COMBO_MAP)));
+}
+
+void test_truncated_and_empty(void)
+{
+  TEST_ASSERT_EQUAL_HEX8(0, report_map_applications(KEYBOARD_MAP, 5));
+  TEST_ASSERT_EQUAL_HEX8(0, report_map_applications(nullptr, 0));
+  const uint8_t long_item[] = {0xFE, 0x10};
+  TEST_ASSERT_EQUAL_HEX8(0, report_map_applications(long_item, sizeof(long_item)));
+}
+
+void test_output_reports(void)
+{
+  bool pid;
+  TEST_ASSERT_EQUAL_UINT32(8, report_map_output_size(OUTPUT_MAP, sizeof(OUTPUT_MAP), 3, pid));
+  TEST_ASSERT_TRUE(pid);
+  TEST_ASSERT_EQUAL_UINT32(1, report_map_output_size(OUTPUT_MAP, sizeof(OUTPUT_MAP), 1, pid));
+  TEST_ASSERT_FALSE(pid);
+  /** Not declared: no rumble target, whatever the characteristic says */
+  TEST_ASSERT_EQUAL_UINT32(0, report_map_output_size(OUTPUT_MAP, sizeof(OUTPUT_MAP), 2, pid));
+  TEST_ASSERT_EQUAL_UINT32(0, report_map_output_size(COMBO_MAP, sizeof(COMBO_MAP), 3, pid));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_keyboard);
+  RUN_TEST(test_mouse_ignores_nested_collections);
+  RUN_TEST(test_combo_pad_declares_gamepad);
+  RUN_TEST(test_truncated_and_empty);
+  RUN_TEST(test_output_reports);
+  return UNITY_END();
+}